@@ -1,3 +1,6 @@
+// Build: g++ -std=c++17 -O2 -pthread main.cpp -o csci251_a1.app
+// As a library, see weather_engine.h
+
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -5,7 +8,42 @@
 #include <vector>
 #include <iomanip>
 #include <cctype>
+#include <cstring>
+#include <cerrno>
 #include <map>
+#include <array>
+#include <chrono>
+#include <new>
+#include <algorithm>
+#include <cstdint>
+#include <climits>
+#include <string_view>
+#include <charconv>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <exception>
+#include <stdexcept>
+#include <cstdlib>
+#include <sys/mman.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "weather_engine.h"
 using namespace std;
 
 // ---------------
@@ -14,1034 +52,5483 @@ using namespace std;
 struct City {
     int x, y;
     int id;
-    string name;
+    uint32_t name; // handle into the dataset's CityNames
 };
 
-// Variables for grid dimensions
-int gridX_min = 0, gridX_max = 8, gridY_min = 0, gridY_max = 8;
-int grid_width = 9, grid_height = 9;
-
-// Dynamic 2D arrays for different data types
-int** cityGrid = nullptr;
-int** cloudData = nullptr;
-int** pressureData = nullptr;
-
-// File names read from configuration file
-string cityFileName = "";
-string cloudFileName = "";
-string pressureFileName = "";
-
-// To store all city information and to check if config has been loaded
-vector<City> cities;
-bool configLoaded = false;
-
 // ----------------------
 // Function Declarations
 // ----------------------
-bool readCityData();
-bool readCloudData();
-bool readPressureData();
+bool isSnapshotFile(const string& path);
+int rainProbabilityFor(char accSymbol, char apSymbol);
 int getValidChoice();
 void waitForEnter();
 
-// --------------------------
-// Memory Management Function 
-// --------------------------
-void allocateGrids() {
-    // Clean up existing grids first
-    if (cityGrid) {
-        for (int i = 0; i < grid_height; i++) {
-            delete[] cityGrid[i]; // Delete each row
+// ----------------------
+// Contiguous Grid Layer
+// ----------------------
+// Stores a whole layer in one cache-line aligned buffer (row-major, no per-row
+// allocations). Cells are addressed either by grid index (0..width-1,
+// 0..height-1) or by world coordinate, using the origin given at reset().
+template <typename T>
+class Grid {
+public:
+    static constexpr size_t Alignment = 64;
+
+    Grid() = default;
+    ~Grid() { release(); }
+
+    Grid(const Grid&) = delete;
+    Grid& operator=(const Grid&) = delete;
+
+    Grid(Grid&& other) noexcept { swap(other); }
+    Grid& operator=(Grid&& other) noexcept {
+        if (this != &other) {
+            release();
+            w = h = 0;
+            swap(other);
         }
-        delete[] cityGrid; // Delete the array of pointers
+        return *this;
     }
-    if (cloudData) {
-        for (int i = 0; i < grid_height; i++) {
-            delete[] cloudData[i];
+
+    // Resize to width x height with (originX, originY) as world coordinate of cell [0][0].
+    // All cells are zeroed. The buffer is only reallocated when it has to grow.
+    void reset(int width, int height, int originX, int originY) {
+        size_t cells = (width > 0 && height > 0) ? (size_t)width * (size_t)height : 0;
+        w = (cells > 0) ? width : 0;
+        h = (cells > 0) ? height : 0;
+        x0 = originX;
+        y0 = originY;
+        if (owner_) release(); // stop viewing borrowed cells
+        if (cells > capacity) {
+            allocate(cells); // fresh memory is already zeroed
+        } else {
+            clear();
         }
-        delete[] cloudData;
     }
-    if (pressureData) {
-        for (int i = 0; i < grid_height; i++) {
-            delete[] pressureData[i];
-        }
-        delete[] pressureData;
+
+    // Set every cell back to zero
+    void clear() {
+        std::fill(cells_, cells_ + size(), T());
     }
-    
-    // Calculate new grid dimensions (total columns & rows)
-    grid_width = gridX_max - gridX_min + 1; 
-    grid_height = gridY_max - gridY_min + 1;  
-    
-    // Allocate city grid (store city IDs)
-    cityGrid = new int*[grid_height];
-    for (int i = 0; i < grid_height; i++) {
-        cityGrid[i] = new int[grid_width];
-        for (int j = 0; j < grid_width; j++) {
-            cityGrid[i][j] = 0; // 0 means no city
-        }
+
+    // Use cells that live in someone else's memory, e.g. a mapped snapshot.
+    // 'owner' keeps that memory alive; the next reset() goes back to a buffer
+    // of the grid's own.
+    void view(T* cells, int width, int height, int originX, int originY, shared_ptr<void> owner) {
+        release();
+        cells_ = cells;
+        owner_ = std::move(owner);
+        w = width;
+        h = height;
+        x0 = originX;
+        y0 = originY;
     }
-    
-    // Allocate cloud data grid (store cloud values 0-99)
-    cloudData = new int*[grid_height];
-    for (int i = 0; i < grid_height; i++) {
-        cloudData[i] = new int[grid_width];
-        for (int j = 0; j < grid_width; j++) {
-            cloudData[i][j] = 0;
+
+    int width() const { return w; }
+    int height() const { return h; }
+    int originX() const { return x0; }
+    int originY() const { return y0; }
+    size_t size() const { return (size_t)w * (size_t)h; }
+    bool empty() const { return size() == 0; }
+
+    // Bounds checks by grid index and by world coordinate
+    bool inBounds(int gx, int gy) const {
+        return gx >= 0 && gx < w && gy >= 0 && gy < h;
+    }
+    bool containsWorld(int x, int y) const {
+        return inBounds(x - x0, y - y0);
+    }
+
+    // Unchecked cell access, callers check bounds first
+    T& at(int gx, int gy) { return cells_[(size_t)gy * w + gx]; }
+    const T& at(int gx, int gy) const { return cells_[(size_t)gy * w + gx]; }
+    T& atWorld(int x, int y) { return at(x - x0, y - y0); }
+    const T& atWorld(int x, int y) const { return at(x - x0, y - y0); }
+
+    T* row(int gy) { return cells_ + (size_t)gy * w; }
+    const T* row(int gy) const { return cells_ + (size_t)gy * w; }
+    T* data() { return cells_; }
+    const T* data() const { return cells_; }
+
+private:
+    // Large layers come straight from mmap: the pages are zero-filled by the
+    // kernel and only faulted in when first touched, so a huge grid costs
+    // nothing until it is used. Small layers use the aligned heap.
+    static constexpr size_t MapThreshold = 1 << 20;
+
+    void allocate(size_t cells) {
+        release();
+        size_t bytes = cells * sizeof(T);
+        if (bytes >= MapThreshold) {
+            void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED) throw bad_alloc();
+            cells_ = static_cast<T*>(p);
+            mapped = true;
+        } else {
+            cells_ = static_cast<T*>(::operator new(bytes, std::align_val_t(Alignment)));
+            std::fill(cells_, cells_ + cells, T());
         }
+        capacity = cells;
     }
-    
-    // Allocate pressure data grid (store pressure values 0-99)
-    pressureData = new int*[grid_height];
-    for (int i = 0; i < grid_height; i++) {
-        pressureData[i] = new int[grid_width];
-        for (int j = 0; j < grid_width; j++) {
-            pressureData[i][j] = 0;
+
+    void release() {
+        if (owner_) {
+            owner_.reset(); // not ours to free
+        } else if (cells_) {
+            if (mapped) {
+                munmap(cells_, capacity * sizeof(T));
+            } else {
+                ::operator delete(cells_, std::align_val_t(Alignment));
+            }
         }
+        cells_ = nullptr;
+        capacity = 0;
+        mapped = false;
     }
-}
 
-// To free all allocated memory, called at program exit to prevent memory leaks
-void deallocateGrids() {
-    if (cityGrid) {
-        for (int i = 0; i < grid_height; i++) {
-            delete[] cityGrid[i]; // Delete each row
+    void swap(Grid& other) noexcept {
+        std::swap(cells_, other.cells_);
+        std::swap(capacity, other.capacity);
+        std::swap(mapped, other.mapped);
+        std::swap(owner_, other.owner_);
+        std::swap(w, other.w);
+        std::swap(h, other.h);
+        std::swap(x0, other.x0);
+        std::swap(y0, other.y0);
+    }
+
+    T* cells_ = nullptr;
+    size_t capacity = 0;
+    bool mapped = false;
+    shared_ptr<void> owner_; // set for views
+    int w = 0, h = 0;
+    int x0 = 0, y0 = 0;
+};
+
+// -----------------
+// Sparse Tiled Grid
+// -----------------
+// Same addressing as Grid, but cells are kept in 64x64 tiles that are only
+// allocated when a non-zero value is first written. Every untouched tile
+// points at one shared tile of zeros, so reads never need a null check and
+// memory grows with the number of touched tiles rather than the grid area.
+template <typename T>
+class TiledGrid {
+public:
+    static constexpr int TileShift = 6;
+    static constexpr int TileSize = 1 << TileShift; // cells per tile side
+    static constexpr size_t TileCells = (size_t)TileSize * TileSize;
+
+    TiledGrid() = default;
+    TiledGrid(const TiledGrid&) = delete;
+    TiledGrid& operator=(const TiledGrid&) = delete;
+    TiledGrid(TiledGrid&&) = default;
+    TiledGrid& operator=(TiledGrid&&) = default;
+
+    // Resize to width x height with every tile back to the shared zero tile
+    void reset(int width, int height, int originX, int originY) {
+        bool hasCells = width > 0 && height > 0;
+        w = hasCells ? width : 0;
+        h = hasCells ? height : 0;
+        x0 = originX;
+        y0 = originY;
+        tilesX = (w + TileSize - 1) >> TileShift;
+        owned.clear();
+        tiles.assign((size_t)tilesX * (size_t)((h + TileSize - 1) >> TileShift), zeroTile());
+    }
+
+    int width() const { return w; }
+    int height() const { return h; }
+    int originX() const { return x0; }
+    int originY() const { return y0; }
+    size_t size() const { return (size_t)w * (size_t)h; }
+    bool empty() const { return size() == 0; }
+
+    bool inBounds(int gx, int gy) const {
+        return gx >= 0 && gx < w && gy >= 0 && gy < h;
+    }
+    bool containsWorld(int x, int y) const {
+        return inBounds(x - x0, y - y0);
+    }
+
+    // Unchecked reads, callers check bounds first
+    T at(int gx, int gy) const {
+        return tiles[tileIndex(gx, gy)][cellIndex(gx, gy)];
+    }
+    T atWorld(int x, int y) const { return at(x - x0, y - y0); }
+
+    // Unchecked write; the tile is allocated on the first non-zero value
+    void set(int gx, int gy, T value) {
+        const T*& tile = tiles[tileIndex(gx, gy)];
+        if (tile == zeroTile()) {
+            if (value == T()) return;
+            owned.emplace_back(new T[TileCells]());
+            tile = owned.back().get();
         }
-        delete[] cityGrid; // Delete array of pointers
-        cityGrid = nullptr; // Set pointer to null
+        const_cast<T*>(tile)[cellIndex(gx, gy)] = value;
     }
-    
-    if (cloudData) {
-        for (int i = 0; i < grid_height; i++) {
-            delete[] cloudData[i];
+    void setWorld(int x, int y, T value) { set(x - x0, y - y0, value); }
+
+private:
+    static const T* zeroTile() {
+        static const T zeros[TileCells] = {};
+        return zeros;
+    }
+
+    size_t tileIndex(int gx, int gy) const {
+        return (size_t)(gy >> TileShift) * tilesX + (size_t)(gx >> TileShift);
+    }
+    static size_t cellIndex(int gx, int gy) {
+        return (size_t)(gy & (TileSize - 1)) * TileSize + (size_t)(gx & (TileSize - 1));
+    }
+
+    vector<const T*> tiles;         // tilesX per tile row, zero tile if untouched
+    vector<unique_ptr<T[]>> owned;  // the allocated tiles
+    int tilesX = 0;
+    int w = 0, h = 0;
+    int x0 = 0, y0 = 0;
+};
+
+// ----------------
+// City ID Layer
+// ----------------
+// City IDs are stored in the narrowest integer type that holds every ID in the
+// city file: 1 byte for the usual 1-255 range, 2 bytes up to 65535, else 4.
+// Cities cover a small part of the grid, so the IDs live in a sparse tiled
+// grid and only the tiles that hold a city take memory.
+class CityLayer {
+public:
+    void reset(int width, int height, int originX, int originY) {
+        w = width;
+        h = height;
+        x0 = originX;
+        y0 = originY;
+        ids16 = TiledGrid<uint16_t>();
+        ids32 = TiledGrid<int32_t>();
+        idBytes = 1;
+        ids8.reset(w, h, x0, y0);
+    }
+
+    // Rebuild the layer from the parsed city list (later entries win)
+    void build(const vector<City>& list) {
+        int minID = 0, maxID = 0;
+        for (const City& city : list) {
+            minID = min(minID, city.id);
+            maxID = max(maxID, city.id);
         }
-        delete[] cloudData;
-        cloudData = nullptr;
+        int bytes = (minID >= 0 && maxID <= UINT8_MAX) ? 1 : (minID >= 0 && maxID <= UINT16_MAX) ? 2 : 4;
+        
+        reset(w, h, x0, y0);
+        idBytes = bytes;
+        if (bytes == 1) fill(ids8, list);
+        else if (bytes == 2) fill(ids16, list);
+        else fill(ids32, list);
     }
-    
-    if (pressureData) {
-        for (int i = 0; i < grid_height; i++) {
-            delete[] pressureData[i];
+
+    bool empty() const { return ids8.empty() && ids16.empty() && ids32.empty(); }
+    int bytesPerCell() const { return idBytes; }
+
+    bool containsWorld(int x, int y) const {
+        return idBytes == 1 ? ids8.containsWorld(x, y) : idBytes == 2 ? ids16.containsWorld(x, y) : ids32.containsWorld(x, y);
+    }
+    int atWorld(int x, int y) const {
+        return idBytes == 1 ? ids8.atWorld(x, y) : idBytes == 2 ? ids16.atWorld(x, y) : ids32.atWorld(x, y);
+    }
+
+private:
+    template <typename T>
+    void fill(TiledGrid<T>& grid, const vector<City>& list) {
+        grid.reset(w, h, x0, y0);
+        for (const City& city : list) {
+            if (grid.containsWorld(city.x, city.y)) {
+                grid.setWorld(city.x, city.y, (T)city.id); // Store city ID at this position
+            }
         }
-        delete[] pressureData;
-        pressureData = nullptr;
     }
-}
 
-// -------------
-// Trim Function
-// -------------
-// Remove whitespace from beginning and end of string
-string trim(const string& str) {
-    size_t first = str.find_first_not_of(" \t\r\n");
-    if (first == string::npos) return "";
-    size_t last = str.find_last_not_of(" \t\r\n");
-    return str.substr(first, (last - first + 1));
-}
+    TiledGrid<uint8_t> ids8;
+    TiledGrid<uint16_t> ids16;
+    TiledGrid<int32_t> ids32;
+    int idBytes = 1;
+    int w = 0, h = 0, x0 = 0, y0 = 0;
+};
 
-// --------------------------
-// Configuration File Reading
-// --------------------------
-// Encourage user to put in filename and read the file line by line
-void readConfigFile() {
-    cout << "Please enter config filename : ";
-    string filename;
-    getline(cin, filename); // Read entire line including spaces
-    
-    filename = trim(filename); // Trim extra whitespaces
-    
-    ifstream file(filename); // Open file for reading
-    if (!file) { // Check if successful or not
-        cout << "Error: Cannot open " << filename << endl;
-        waitForEnter();
-        return;
+// ----------------------
+// Out-of-Core Tile Cache
+// ----------------------
+// A 1-byte layer kept in a temporary file as 64x64 tiles of 4 KiB each (one
+// page), tile rows one after another. Only a bounded number of tiles are
+// resident; the least recently used one is written back if changed and
+// dropped when a new tile is needed. Consecutive misses along a tile row
+// are taken as a row-order scan and the next tiles are read ahead with a
+// single preadv(). All access is serialised by one mutex. get() and set()
+// take it for every cell; loops over many cells pin a tile instead (see
+// TileCache::Pin) and take it once per tile, reading the pinned cells
+// without locking.
+struct TileCacheStats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    size_t writeBacks = 0; // evicted tiles that had to be written
+    size_t prefetched = 0; // tiles read ahead of a scan
+};
+
+class TileCache {
+public:
+    static constexpr int TileShift = 6;
+    static constexpr int TileSize = 1 << TileShift;
+    static constexpr size_t TileBytes = (size_t)TileSize * TileSize;
+    static constexpr size_t MinSlots = 16;
+    static constexpr size_t PrefetchTiles = 8;
+
+    TileCache(int width, int height, size_t budgetBytes) : w(width), h(height) {
+        tilesX = (w + TileSize - 1) >> TileShift;
+        tilesY = (h + TileSize - 1) >> TileShift;
+        size_t tiles = (size_t)tilesX * tilesY;
+        
+        const char* dir = getenv("TMPDIR");
+        string path = string(dir && *dir ? dir : "/tmp") + "/weather-tiles-XXXXXX";
+        fd = mkstemp(&path[0]);
+        if (fd < 0) throw runtime_error("cannot create tile file in " + path.substr(0, path.rfind('/')));
+        ::unlink(path.c_str()); // gone as soon as it is closed
+        if (ftruncate(fd, (off_t)(tiles * TileBytes)) != 0) {
+            ::close(fd);
+            throw runtime_error("cannot size tile file");
+        }
+        
+        size_t slots = min(max(budgetBytes / TileBytes, MinSlots), tiles);
+        memory.reset((int)TileBytes, (int)slots, 0, 0);
+        slotOf.assign(tiles, -1);
+        tileOf.assign(slots, -1);
+        dirty.assign(slots, 0);
+        pins.assign(slots, 0);
+        older.assign(slots, -1);
+        newer.assign(slots, -1);
     }
-    
-    string line;
-    cout << "\nReading config file..." << endl;
-   
-   // Read file line by line 
-    while (getline(file, line)) {
-        line = trim(line);
-        if (line.empty()) continue;
+    ~TileCache() { ::close(fd); }
+
+    TileCache(const TileCache&) = delete;
+    TileCache& operator=(const TileCache&) = delete;
+
+    // A tile held resident for one thread: cell(gx, gy) pins the tile of that
+    // cell, releasing the one pinned before, and returns the cell's address.
+    // Nothing is locked while the pinned tile is used. A thread must hold at
+    // most one pin per cache, as pinning waits while every slot is pinned.
+    class Pin {
+    public:
+        Pin() = default;
+        Pin(TileCache* cache, bool forWrite) : cache(cache), forWrite(forWrite) {}
+        ~Pin() { release(); }
         
-        cout << line << endl; 
+        void open(TileCache* tiles, bool write) {
+            release();
+            cache = tiles;
+            forWrite = write;
+        }
         
-        // Parse Grid X Range
-        if (line.find("GridX_IdxRange") != string::npos) {
-            size_t colonPos = line.find(':');
-            if (colonPos != string::npos) {
-                string rangeStr = trim(line.substr(colonPos + 1)); // Get part after ::
-                size_t dashPos = rangeStr.find('-');
-                if (dashPos != string::npos) {
-                    try {
-                        string minStr = trim(rangeStr.substr(0, dashPos));
-                        string maxStr = trim(rangeStr.substr(dashPos + 1));
-                        gridX_min = stoi(minStr); // Convert to integer
-                        gridX_max = stoi(maxStr);
-                    } catch (const exception& e) {
-                        cout << "Warning: Could not parse GridX_IdxRange" << endl;
-                    }
-                }
+        Pin(const Pin&) = delete;
+        Pin& operator=(const Pin&) = delete;
+        
+        uint8_t* cell(int gx, int gy) {
+            size_t t = cache->tileIndex(gx, gy);
+            if (t != pinned) {
+                release();
+                cells = cache->pin(t, forWrite);
+                pinned = t;
             }
+            return cells + cellIndex(gx, gy);
         }
-        // Parge Grid Y Range
-        else if (line.find("GridY_IdxRange") != string::npos) {
-            size_t colonPos = line.find(':');
-            if (colonPos != string::npos) {
-                string rangeStr = trim(line.substr(colonPos + 1));
-                size_t dashPos = rangeStr.find('-');
-                if (dashPos != string::npos) {
-                    try {
-                        string minStr = trim(rangeStr.substr(0, dashPos));
-                        string maxStr = trim(rangeStr.substr(dashPos + 1));
-                        gridY_min = stoi(minStr);
-                        gridY_max = stoi(maxStr);
-                    } catch (const exception& e) {
-                        cout << "Warning: Could not parse GridY_IdxRange" << endl;
-                    }
+        void release() {
+            if (pinned != SIZE_MAX) cache->unpin(pinned);
+            pinned = SIZE_MAX;
+        }
+        
+    private:
+        TileCache* cache = nullptr;
+        bool forWrite = false;
+        size_t pinned = SIZE_MAX;
+        uint8_t* cells = nullptr;
+    };
+
+    uint8_t get(int gx, int gy) {
+        unique_lock<mutex> hold(lock);
+        return tile(tileIndex(gx, gy), false, hold)[cellIndex(gx, gy)];
+    }
+
+    void set(int gx, int gy, uint8_t value) {
+        unique_lock<mutex> hold(lock);
+        tile(tileIndex(gx, gy), true, hold)[cellIndex(gx, gy)] = value;
+    }
+
+    // Copy rows [gy, gy + count) into 'out', one tile at a time in file order
+    void readRows(int gy, int count, uint8_t* out) {
+        unique_lock<mutex> hold(lock);
+        for (int tileRow = gy >> TileShift; tileRow <= (gy + count - 1) >> TileShift; tileRow++) {
+            int first = max(gy, tileRow << TileShift);
+            int last = min(gy + count, (tileRow + 1) << TileShift);
+            for (int tx = 0; tx < tilesX; tx++) {
+                const uint8_t* cells = tile((size_t)tileRow * tilesX + tx, false, hold);
+                int x0 = tx << TileShift;
+                int span = min(TileSize, w - x0);
+                for (int y = first; y < last; y++) {
+                    memcpy(out + (size_t)(y - gy) * w + x0, cells + (size_t)(y & (TileSize - 1)) * TileSize, span);
                 }
             }
         }
-        // Identify Data Files
-        else if (line.find("CityLocation.txt") != string::npos) {
-            cityFileName = trim(line);  
+    }
+
+    // Zero every cell: drop the resident tiles and empty the file
+    void clear() {
+        lock_guard<mutex> hold(lock);
+        off_t bytes = (off_t)(slotOf.size() * TileBytes);
+        if (ftruncate(fd, 0) != 0 || ftruncate(fd, bytes) != 0) throw runtime_error("cannot clear tile file");
+        fill(slotOf.begin(), slotOf.end(), -1);
+        fill(tileOf.begin(), tileOf.end(), -1);
+        fill(dirty.begin(), dirty.end(), 0);
+        fill(pins.begin(), pins.end(), 0);
+        pinnedSlots = 0;
+        usedSlots = 0;
+        newest = oldest = -1;
+        lastMiss = SIZE_MAX;
+    }
+
+    size_t residentBytes() const { return tileOf.size() * TileBytes; }
+    TileCacheStats stats() const {
+        lock_guard<mutex> hold(lock);
+        return counts;
+    }
+
+private:
+    size_t tileIndex(int gx, int gy) const {
+        return (size_t)(gy >> TileShift) * tilesX + (size_t)(gx >> TileShift);
+    }
+    static size_t cellIndex(int gx, int gy) {
+        return (size_t)(gy & (TileSize - 1)) * TileSize + (size_t)(gx & (TileSize - 1));
+    }
+    uint8_t* slotData(int slot) { return memory.row(slot); }
+
+    uint8_t* pin(size_t t, bool forWrite) {
+        unique_lock<mutex> hold(lock);
+        uint8_t* cells = tile(t, forWrite, hold);
+        if (pins[slotOf[t]]++ == 0) pinnedSlots++;
+        return cells;
+    }
+    void unpin(size_t t) {
+        lock_guard<mutex> hold(lock);
+        if (--pins[slotOf[t]] == 0) {
+            pinnedSlots--;
+            slotReleased.notify_all();
         }
-        else if (line.find("CloudCover.txt") != string::npos) {
-            cloudFileName = trim(line);  
+    }
+
+    // The resident copy of tile 't', loading it (and maybe the next few) on a
+    // miss. A miss needs a slot that isn't pinned and waits for one if need be.
+    uint8_t* tile(size_t t, bool forWrite, unique_lock<mutex>& hold) {
+        if (slotOf[t] < 0 && pinnedSlots == tileOf.size()) {
+            slotReleased.wait(hold, [&] { return slotOf[t] >= 0 || pinnedSlots < tileOf.size(); });
         }
-        else if (line.find("Pressure.txt") != string::npos) {
-            pressureFileName = trim(line); 
+        int slot = slotOf[t];
+        if (slot >= 0) {
+            counts.hits++;
+            touch(slot);
+        } else {
+            counts.misses++;
+            slot = load(t);
         }
+        if (forWrite) dirty[slot] = 1;
+        return slotData(slot);
     }
-    file.close();
-    
-    // Allocate memory grids based on parsed dimensions
-    allocateGrids();
-    configLoaded = true; // mark config as loaded
-    
-    // Display sumary of what file was loaded
-    cout << "\nConfiguration loaded successfully!" << endl;
-    cout << "Grid dimensions: [" << gridX_min << "-" << gridX_max << "] x [" << gridY_min << "-" << gridY_max << "]" << endl;
-    if (!cityFileName.empty()) cout << "City file: " << cityFileName << endl;
-    if (!cloudFileName.empty()) cout << "Cloud file: " << cloudFileName << endl;  
-    if (!pressureFileName.empty()) cout << "Pressure file: " << pressureFileName << endl;
-    
-    waitForEnter(); 
-}
 
-// --------------------------
-// Data File Reading Function
-// --------------------------
-bool readCityData() {
-    if (cityFileName.empty()) {
-        cout << "Error: City filename not found. Please read config file first!" << endl;
-        return false;
-    }
-    
-    ifstream file(cityFileName);
-    if (!file) {
-        cout << "Error: Cannot open " << cityFileName << endl;
-        return false;
-    }
-    
-    cities.clear(); // clear existing city if any
-    
-    // Clear city grid
-    for (int i = 0; i < grid_height; i++) {
-        for (int j = 0; j < grid_width; j++) {
-            cityGrid[i][j] = 0;
+    int load(size_t t) {
+        // A miss right after the previous tile looks like a scan, read ahead
+        // along the tile row, leaving room for what the caller still holds
+        size_t ahead = 0;
+        if (t == lastMiss + 1) {
+            size_t rowEnd = (t / tilesX + 1) * tilesX;
+            size_t limit = min({ PrefetchTiles, tileOf.size() / 4, tileOf.size() - pinnedSlots - 1 });
+            while (ahead < limit && t + 1 + ahead < rowEnd && slotOf[t + 1 + ahead] < 0) ahead++;
+        }
+        lastMiss = t + ahead;
+        
+        iovec parts[1 + PrefetchTiles];
+        int slots[1 + PrefetchTiles];
+        for (size_t i = 0; i <= ahead; i++) {
+            slots[i] = freeSlot();
+            slotOf[t + i] = slots[i];
+            tileOf[slots[i]] = (int)(t + i);
+            parts[i] = { slotData(slots[i]), TileBytes };
         }
+        counts.prefetched += ahead;
+        
+        // The requested tile is filled last so it ends up most recently used
+        for (size_t i = ahead + 1; i-- > 0;) touch(slots[i]);
+        if (preadv(fd, parts, (int)(ahead + 1), (off_t)(t * TileBytes)) != (ssize_t)((ahead + 1) * TileBytes)) {
+            throw runtime_error("cannot read tile file");
+        }
+        return slots[0];
     }
-    
-    string line;
-    while (getline(file, line)) {
-        line = trim(line);
-        if (line.empty()) continue;
+
+    // An unused slot, or the least recently used unpinned one after writing it back
+    int freeSlot() {
+        if (usedSlots < tileOf.size()) return (int)usedSlots++;
         
-        try {
-            City city;
-            // Parse format: [x, y]-id-Name
-            size_t start = line.find('[');
-            size_t comma = line.find(',');
-            size_t end = line.find(']');
-            
-            if (start == string::npos || comma == string::npos || end == string::npos) {
-                continue; // Skip malformed lines
-            }
-            
-            // Extract X & Y Coordinates
-            city.x = stoi(trim(line.substr(start + 1, comma - start - 1)));
-            city.y = stoi(trim(line.substr(comma + 1, end - comma - 1)));
-            
-            // Find the parts after ]
-            string remaining = line.substr(end + 1);
-            size_t dash1 = remaining.find('-');
-            size_t dash2 = remaining.find('-', dash1 + 1);
-            
-            if (dash1 != string::npos && dash2 != string::npos) {
-                city.id = stoi(trim(remaining.substr(dash1 + 1, dash2 - dash1 - 1)));
-                city.name = trim(remaining.substr(dash2 + 1));
-            }
-            
-            cities.push_back(city); // Add city to vector
-            
-            // Mark city in grid
-            int gridX = city.x - gridX_min; // Convert world coords to grid coord
-            int gridY = city.y - gridY_min;
-            if (gridX >= 0 && gridX < grid_width && gridY >= 0 && gridY < grid_height) {
-                cityGrid[gridY][gridX] = city.id; // Store city ID at this position
+        int slot = oldest;
+        while (pins[slot] > 0) slot = newer[slot];
+        unlink(slot);
+        counts.evictions++;
+        if (dirty[slot]) {
+            counts.writeBacks++;
+            if (pwrite(fd, slotData(slot), TileBytes, (off_t)tileOf[slot] * TileBytes) != (ssize_t)TileBytes) {
+                throw runtime_error("cannot write tile file");
             }
-        } catch (const exception& e) {
-            cout << "Warning: Could not parse line: " << line << endl;
+            dirty[slot] = 0;
         }
+        slotOf[tileOf[slot]] = -1;
+        tileOf[slot] = -1;
+        return slot;
     }
-    file.close();
-    return true;
-}
 
-bool readCloudData() {
-    if (cloudFileName.empty()) {
-        cout << "Error: Cloud filename not found. Please read config file first!" << endl;
-        return false;
+    // LRU list over slots, newest first
+    void unlink(int slot) {
+        if (newer[slot] >= 0) older[newer[slot]] = older[slot]; else if (newest == slot) newest = older[slot];
+        if (older[slot] >= 0) newer[older[slot]] = newer[slot]; else if (oldest == slot) oldest = newer[slot];
+        older[slot] = newer[slot] = -1;
     }
-    
-    ifstream file(cloudFileName);
-    if (!file) {
-        cout << "Error: Cannot open " << cloudFileName << endl;
-        return false;
+    void touch(int slot) {
+        if (newest == slot) return;
+        unlink(slot);
+        older[slot] = newest;
+        if (newest >= 0) newer[newest] = slot;
+        newest = slot;
+        if (oldest < 0) oldest = slot;
     }
-    
-    string line;
-    while (getline(file, line)) {
-        line = trim(line);
-        if (line.empty()) continue;
-        
-        try {
-            // Parse format: [x, y]-value
-            size_t start = line.find('[');
-            size_t comma = line.find(',');
-            size_t end = line.find(']');
-            size_t dash = line.find('-', end); 
-            
-            if (start == string::npos || comma == string::npos || 
-                end == string::npos || dash == string::npos) {
-                continue; // Skip malformed lines
-            }
-            
-            // Extract coordinates and value
-            int x = stoi(trim(line.substr(start + 1, comma - start - 1)));
-            int y = stoi(trim(line.substr(comma + 1, end - comma - 1)));
-            int value = stoi(trim(line.substr(dash + 1)));
-            
-            // Store in grid
-            int gridX = x - gridX_min;
-            int gridY = y - gridY_min;
-            if (gridX >= 0 && gridX < grid_width && gridY >= 0 && gridY < grid_height) {
-                cloudData[gridY][gridX] = value;
-            }
-        } catch (const exception& e) {
-            cout << "Warning: Could not parse cloud data line: " << line << endl;
+
+    mutable mutex lock;
+    condition_variable slotReleased; // a pinned slot became free to evict
+    int fd = -1;
+    int w, h;
+    int tilesX = 0, tilesY = 0;
+    Grid<uint8_t> memory;    // one 4 KiB row per slot
+    vector<int> slotOf;      // per tile, -1 when not resident
+    vector<int> tileOf;      // per slot, -1 when free
+    vector<uint8_t> dirty;   // per slot
+    vector<int> pins;        // per slot, pins held on its tile
+    size_t pinnedSlots = 0;  // slots with pins > 0
+    vector<int> older, newer;
+    int newest = -1, oldest = -1;
+    size_t usedSlots = 0;
+    size_t lastMiss = SIZE_MAX;
+    TileCacheStats counts;
+};
+
+// Bytes each of the cloud and pressure layers may keep in memory, set with
+// --memory-budget; 0 means no limit. A layer bigger than this lives in a
+// TileCache instead of a Grid. Only those two layers are covered: the city
+// IDs, classified maps, region tables and rain field are held in full.
+size_t valueLayerBudget = 0;
+
+// -----------
+// Value Layer
+// -----------
+// The cloud and pressure layers: a plain Grid, or a TileCache when the layer
+// is over the memory budget. Reads and writes go through at()/set(), and
+// scans take whole rows with rows(), which only copies when out of core.
+class ValueLayer {
+public:
+    void reset(int width, int height, int originX, int originY) {
+        size_t cells = (width > 0 && height > 0) ? (size_t)width * (size_t)height : 0;
+        w = (cells > 0) ? width : 0;
+        h = (cells > 0) ? height : 0;
+        x0 = originX;
+        y0 = originY;
+        if (valueLayerBudget > 0 && cells > valueLayerBudget) {
+            grid.reset(0, 0, x0, y0);
+            tiles = make_unique<TileCache>(w, h, valueLayerBudget);
+        } else {
+            tiles.reset();
+            grid.reset(w, h, x0, y0);
         }
     }
-    file.close();
-    return true;
-}
 
-// ---------------------------
-// Read Pressure Data Function
-// ---------------------------
-bool readPressureData() {
-    if (pressureFileName.empty()) {
-        cout << "Error: Pressure filename not found. Please read config file first!" << endl;
-        return false;
+    // Point at cells stored elsewhere (see Grid::view)
+    void view(uint8_t* cells, int width, int height, int originX, int originY, shared_ptr<void> owner) {
+        tiles.reset();
+        w = width;
+        h = height;
+        x0 = originX;
+        y0 = originY;
+        grid.view(cells, w, h, x0, y0, std::move(owner));
     }
-    
-    ifstream file(pressureFileName);
-    if (!file) {
-        cout << "Error: Cannot open " << pressureFileName << endl;
-        return false;
+
+    void clear() {
+        if (tiles) tiles->clear(); else grid.clear();
     }
-    
+
+    int width() const { return w; }
+    int height() const { return h; }
+    int originX() const { return x0; }
+    int originY() const { return y0; }
+    size_t size() const { return (size_t)w * (size_t)h; }
+    bool empty() const { return size() == 0; }
+    bool outOfCore() const { return tiles != nullptr; }
+
+    bool inBounds(int gx, int gy) const {
+        return gx >= 0 && gx < w && gy >= 0 && gy < h;
+    }
+    bool containsWorld(int x, int y) const {
+        return inBounds(x - x0, y - y0);
+    }
+
+    // Unchecked cell access, callers check bounds first
+    uint8_t at(int gx, int gy) const { return tiles ? tiles->get(gx, gy) : grid.at(gx, gy); }
+    uint8_t atWorld(int x, int y) const { return at(x - x0, y - y0); }
+    void set(int gx, int gy, uint8_t value) {
+        if (tiles) tiles->set(gx, gy, value); else grid.at(gx, gy) = value;
+    }
+    void setWorld(int x, int y, uint8_t value) { set(x - x0, y - y0, value); }
+
+    // Rows [gy, gy + count) back to back; 'scratch' holds them when out of core
+    const uint8_t* rows(int gy, int count, vector<uint8_t>& scratch) const {
+        if (!tiles) return grid.row(gy);
+        scratch.resize((size_t)count * w);
+        tiles->readRows(gy, count, scratch.data());
+        return scratch.data();
+    }
+
+    const TileCache* tileCache() const { return tiles.get(); }
+
+    // Cell access for loops on one thread. In core these are at() and set();
+    // out of core they keep the current tile pinned, so the cache is locked
+    // once per tile rather than once per cell.
+    class Reader {
+    public:
+        Reader() = default;
+        explicit Reader(const ValueLayer& layer) { open(layer); }
+        void open(const ValueLayer& layer) {
+            grid = &layer.grid;
+            pin.open(layer.tiles.get(), false);
+            outOfCore = layer.tiles != nullptr;
+        }
+        uint8_t at(int gx, int gy) { return outOfCore ? *pin.cell(gx, gy) : grid->at(gx, gy); }
+        
+    private:
+        const Grid<uint8_t>* grid = nullptr;
+        TileCache::Pin pin;
+        bool outOfCore = false;
+    };
+    
+    class Writer {
+    public:
+        explicit Writer(ValueLayer& layer) : layer(layer), pin(layer.tiles.get(), true) {}
+        uint8_t at(int gx, int gy) { return layer.tiles ? *pin.cell(gx, gy) : layer.grid.at(gx, gy); }
+        void set(int gx, int gy, uint8_t value) {
+            if (layer.tiles) *pin.cell(gx, gy) = value; else layer.grid.at(gx, gy) = value;
+        }
+        uint8_t atWorld(int x, int y) { return at(x - layer.x0, y - layer.y0); }
+        void setWorld(int x, int y, uint8_t value) { set(x - layer.x0, y - layer.y0, value); }
+        bool containsWorld(int x, int y) const { return layer.containsWorld(x, y); }
+        
+    private:
+        ValueLayer& layer;
+        TileCache::Pin pin;
+    };
+
+private:
+    Grid<uint8_t> grid;
+    unique_ptr<TileCache> tiles;
+    int w = 0, h = 0;
+    int x0 = 0, y0 = 0;
+};
+
+// -------------
+// Trim Function
+// -------------
+// Remove whitespace from beginning and end of string
+string trim(const string& str) {
+    size_t first = str.find_first_not_of(" \t\r\n");
+    if (first == string::npos) return "";
+    size_t last = str.find_last_not_of(" \t\r\n");
+    return str.substr(first, (last - first + 1));
+}
+
+// -----------------
+// Data Line Parser
+// -----------------
+// Shared by every data file reader. Works on string_views into the line and
+// never allocates or throws; bad lines are reported through LineStatus and
+// counted in ParseStats. Field extraction mirrors the original
+// substr()/trim()/stoi() code so results are identical.
+
+// Counts for one pass over a data file
+struct ParseStats {
+    size_t lines = 0;      // non-blank lines seen
+    size_t stored = 0;     // lines accepted
+    size_t skipped = 0;    // lines without the [x, y] markers, silently ignored
+    size_t malformed = 0;  // lines with a field that is not a number
+    size_t outOfRange = 0; // values outside 0-99
+
+    void clear() { *this = ParseStats(); }
+
+    void add(const ParseStats& other) {
+        lines += other.lines;
+        stored += other.stored;
+        skipped += other.skipped;
+        malformed += other.malformed;
+        outOfRange += other.outOfRange;
+    }
+};
+
+enum class LineStatus { Blank, Ok, Skipped, Malformed };
+
+string_view trimView(string_view str) {
+    size_t first = str.find_first_not_of(" \t\r\n");
+    if (first == string_view::npos) return string_view();
+    size_t last = str.find_last_not_of(" \t\r\n");
+    return str.substr(first, (last - first + 1));
+}
+
+// Same semantics as string::substr, but reports a bad position instead of throwing
+bool subView(string_view str, size_t pos, size_t len, string_view& out) {
+    if (pos > str.size()) return false;
+    out = str.substr(pos, len);
+    return true;
+}
+
+// Parse a trimmed field the way stoi() does: leading spaces, optional sign,
+// at least one digit, trailing characters ignored, must fit in an int
+bool parseIntField(string_view field, int& out) {
+    const char* p = field.data();
+    const char* last = p + field.size();
+    while (p != last && isspace((unsigned char)*p)) p++;
+    if (p != last && *p == '+') {
+        p++;
+        if (p == last || !isdigit((unsigned char)*p)) return false;
+    }
+    from_chars_result result = from_chars(p, last, out);
+    return result.ec == errc();
+}
+
+bool parseIntAt(string_view line, size_t pos, size_t len, int& out) {
+    string_view field;
+    return subView(line, pos, len, field) && parseIntField(trimView(field), out);
+}
+
+// Format: [x, y]-value
+// 'line' is set to the trimmed line, which is what warnings print
+LineStatus parseValueLine(string_view raw, string_view& line, int& x, int& y, int& value) {
+    line = trimView(raw);
+    if (line.empty()) return LineStatus::Blank;
+    
+    size_t start = line.find('[');
+    size_t comma = line.find(',');
+    size_t end = line.find(']');
+    size_t dash = line.find('-', end);
+    if (start == string_view::npos || comma == string_view::npos ||
+        end == string_view::npos || dash == string_view::npos) {
+        return LineStatus::Skipped;
+    }
+    
+    if (!parseIntAt(line, start + 1, comma - start - 1, x) ||
+        !parseIntAt(line, comma + 1, end - comma - 1, y) ||
+        !parseIntAt(line, dash + 1, string_view::npos, value)) {
+        return LineStatus::Malformed;
+    }
+    return LineStatus::Ok;
+}
+
+// Format: [x, y]-id-Name
+// A line without the two dashes after ']' gives id 0 and an empty name
+LineStatus parseCityLine(string_view raw, string_view& line, int& x, int& y, int& id, string_view& name) {
+    line = trimView(raw);
+    if (line.empty()) return LineStatus::Blank;
+    
+    size_t start = line.find('[');
+    size_t comma = line.find(',');
+    size_t end = line.find(']');
+    if (start == string_view::npos || comma == string_view::npos || end == string_view::npos) {
+        return LineStatus::Skipped;
+    }
+    
+    if (!parseIntAt(line, start + 1, comma - start - 1, x) ||
+        !parseIntAt(line, comma + 1, end - comma - 1, y)) {
+        return LineStatus::Malformed;
+    }
+    
+    // Find the parts after ]
+    string_view remaining = line.substr(end + 1);
+    size_t dash1 = remaining.find('-');
+    size_t dash2 = remaining.find('-', dash1 + 1);
+    id = 0;
+    name = string_view();
+    if (dash1 != string_view::npos && dash2 != string_view::npos) {
+        if (!parseIntAt(remaining, dash1 + 1, dash2 - dash1 - 1, id)) {
+            return LineStatus::Malformed;
+        }
+        name = trimView(remaining.substr(dash2 + 1));
+    }
+    return LineStatus::Ok;
+}
+
+// ---------------------------
+// Dataset and Forecast Engine
+// ---------------------------
+// Everything loaded for one config lives in a Dataset: the grid range, the
+// data file names, the cities, the three layers and the tables derived from
+// them. ForecastEngine adds the functions that load, query and render a
+// dataset, so a process can hold any number of engines side by side and use
+// each from its own thread. The menu, batch mode, watch mode and the query
+// server are each a client of one engine; other programs use the C API.
+// Only the worker thread count and the memory budget are process-wide.
+
+// File a layer was parsed from, with its size and modification time
+struct LayerCache {
+    string fileName;
+    off_t size = -1;
+    struct timespec mtime = {};
+    bool valid = false;
+    bool fromSnapshot = false; // loaded from a snapshot, there is no file to check
+    bool pinned = false;       // keep what is loaded whatever the file does (see Query Server)
+    
+    size_t hits = 0;   // requests served from memory
+    size_t misses = 0; // requests that had to parse the file
+    size_t generation = 0; // bumped on every load, for data derived from the layer
+    
+    void invalidate() { valid = false; fromSnapshot = false; pinned = false; }
+};
+
+// Prefix sums of one value layer, for the region queries. Entry (x, y) holds
+// the sum of every cell above and left of grid cell (x, y), so a rectangle is
+// four lookups. Like CityLayer it uses 4-byte entries unless the layer total
+// could overflow them.
+class SummedAreaTable {
+public:
+    void build(const ValueLayer& layer) {
+        w = layer.width();
+        h = layer.height();
+        bool wide = 99ull * layer.size() > UINT32_MAX; // values are 0-99
+        if (wide) {
+            sums32 = Grid<uint32_t>();
+            fill(sums64, layer);
+        } else {
+            sums64 = Grid<uint64_t>();
+            fill(sums32, layer);
+        }
+        wideSums = wide;
+    }
+
+    // Sum over grid indexes [gx1..gx2] x [gy1..gy2], which must be in the grid
+    uint64_t sum(int gx1, int gx2, int gy1, int gy2) const {
+        return wideSums ? rectangle(sums64, gx1, gx2, gy1, gy2) : rectangle(sums32, gx1, gx2, gy1, gy2);
+    }
+
+    size_t builtFrom = SIZE_MAX; // LayerCache::generation the table matches
+
+private:
+    template <typename T>
+    void fill(Grid<T>& table, const ValueLayer& layer) {
+        table.reset(w + 1, h + 1, 0, 0); // row 0 and column 0 stay zero
+        const int bandRows = 64;
+        vector<uint8_t> scratch;
+        for (int y = 0; y < h; y += bandRows) {
+            int rows = min(bandRows, h - y);
+            const uint8_t* cells = layer.rows(y, rows, scratch);
+            for (int r = 0; r < rows; r++, cells += w) {
+                const T* above = table.row(y + r);
+                T* out = table.row(y + r + 1);
+                T running = 0;
+                for (int x = 0; x < w; x++) {
+                    running += cells[x];
+                    out[x + 1] = above[x + 1] + running;
+                }
+            }
+        }
+    }
+
+    // Wrapping arithmetic in T is fine, the true result always fits
+    template <typename T>
+    static uint64_t rectangle(const Grid<T>& table, int gx1, int gx2, int gy1, int gy2) {
+        T total = table.at(gx2 + 1, gy2 + 1) - table.at(gx1, gy2 + 1) - table.at(gx2 + 1, gy1) + table.at(gx1, gy1);
+        return total;
+    }
+
+    Grid<uint32_t> sums32;
+    Grid<uint64_t> sums64;
+    bool wideSums = false;
+    int w = 0, h = 0;
+};
+
+// City names, each stored once, back to back in one buffer. A city refers to
+// its name by handle (the order names were first seen), so loading a city
+// costs no allocation of its own and equal names compare as integers.
+class CityNames {
+public:
+    // Handle of 'name', adding it if it is new
+    uint32_t intern(string_view name) {
+        if (2 * (ends.size() + 1) > slots.size()) rehash(max<size_t>(64, 2 * slots.size()));
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash<string_view>()(name) & mask;; i = (i + 1) & mask) {
+            if (slots[i] == NoName) {
+                slots[i] = (uint32_t)ends.size();
+                text.insert(text.end(), name.begin(), name.end());
+                ends.push_back((uint32_t)text.size());
+                return slots[i];
+            }
+            if ((*this)[slots[i]] == name) return slots[i];
+        }
+    }
+
+    // Valid until the next intern(); the text is a vector so it survives moves
+    string_view operator[](uint32_t handle) const {
+        uint32_t begin = handle ? ends[handle - 1] : 0;
+        return string_view(text.data() + begin, ends[handle] - begin);
+    }
+
+    size_t size() const { return ends.size(); }
+
+    void clear() {
+        text.clear();
+        ends.clear();
+        slots.clear();
+    }
+
+private:
+    static constexpr uint32_t NoName = UINT32_MAX;
+
+    // Open addressing with linear probing, kept at most half full
+    void rehash(size_t slotCount) {
+        slots.assign(slotCount, NoName);
+        for (uint32_t handle = 0; handle < ends.size(); handle++) {
+            size_t i = hash<string_view>()((*this)[handle]) & (slotCount - 1);
+            while (slots[i] != NoName) i = (i + 1) & (slotCount - 1);
+            slots[i] = handle;
+        }
+    }
+
+    vector<char> text;     // every name, without separators
+    vector<uint32_t> ends; // name h is text[ends[h - 1] .. ends[h])
+    vector<uint32_t> slots;
+};
+
+// A run of cells in a larger array, e.g. one city's cells in a CityIndex.
+// Converts from a vector, so functions taking one accept either.
+struct CellSpan {
+    const pair<int, int>* first = nullptr;
+    const pair<int, int>* last = nullptr;
+
+    CellSpan() = default;
+    CellSpan(const pair<int, int>* first, const pair<int, int>* last) : first(first), last(last) {}
+    CellSpan(const vector<pair<int, int>>& cells) : first(cells.data()), last(cells.data() + cells.size()) {}
+
+    const pair<int, int>* begin() const { return first; }
+    const pair<int, int>* end() const { return last; }
+    size_t size() const { return last - first; }
+};
+
+// Cells of every city in compressed sparse row form, built once when the
+// cities are loaded. Cities are numbered in name order, as the report lists
+// them; city c has cells[offsets[c] .. offsets[c + 1]) in file order, and its
+// ID is that of its first cell. The report walks these arrays directly.
+struct CityIndex {
+    vector<uint32_t> names;       // name handle of city c
+    vector<int> ids;              // ID of city c
+    vector<uint32_t> offsets;     // one more entry than there are cities
+    vector<pair<int, int>> cells; // (x, y) of every city cell
+
+    size_t size() const { return names.size(); }
+    CellSpan cellsOf(size_t city) const { return CellSpan(cells.data() + offsets[city], cells.data() + offsets[city + 1]); }
+};
+
+struct LoadContext;
+struct MapView;
+struct CityForecast;
+struct RegionStats;
+struct ForecastIndex;
+class OutputBuffer;
+enum class ReportFormat : int;
+
+struct Dataset {
+    // Grid dimensions
+    int gridX_min = 0, gridX_max = 8, gridY_min = 0, gridY_max = 8;
+    int grid_width = 9, grid_height = 9;
+    
+    // File names read from configuration file
+    string cityFileName;
+    string cloudFileName;
+    string pressureFileName;
+    
+    // To store all city information and to check if config has been loaded
+    vector<City> cities;
+    CityNames cityNames;
+    CityIndex cityIndex;
+    bool configLoaded = false;
+    
+    // Grids for the different data types
+    CityLayer cityGrid;         // city IDs, 0 means no city
+    ValueLayer cloudData;       // cloud values 0-99
+    ValueLayer pressureData;    // pressure values 0-99
+    
+    ParseStats cityParseStats;
+    ParseStats cloudParseStats;
+    ParseStats pressureParseStats;
+    
+    LayerCache cityCache;
+    LayerCache cloudCache;
+    LayerCache pressureCache;
+    
+    SummedAreaTable cloudSums;
+    SummedAreaTable pressureSums;
+    
+    Grid<uint8_t> rainField; // rain probability (%) per cell
+    size_t rainBuiltFrom[2] = { SIZE_MAX, SIZE_MAX }; // cloud and pressure LayerCache::generation
+    
+    int perimeterRadius = 1; // see City Perimeter Search
+};
+
+// The functions are defined in the sections they belong to
+class ForecastEngine : public Dataset {
+public:
+    // Configuration File Reading
+    bool loadConfigFile(const string& filename, bool echo, ostream& log);
+    void allocateGrids();
+    void printTileCacheStats(ostream& log);
+    void printParseStats(ostream& log);
+    void printLayerCacheStats(ostream& log);
+    
+    // Data File Reading and Layer Load Cache
+    bool readCityData(LoadContext& ctx);
+    bool readCloudData(LoadContext& ctx);
+    bool readPressureData(LoadContext& ctx);
+    bool readCityData();
+    bool readCloudData();
+    bool readPressureData();
+    void invalidateLayerCaches();
+    bool ensureCityData(LoadContext& ctx);
+    bool ensureCloudData(LoadContext& ctx);
+    bool ensurePressureData(LoadContext& ctx);
+    bool ensureCityData();
+    bool ensureCloudData();
+    bool ensurePressureData();
+    bool ensureAllData(ostream& log);
+    
+    // Binary Snapshot
+    bool writeSnapshot(const string& path, ostream& log);
+    bool loadSnapshot(const string& path, bool verifyLayers, ostream& log);
+    
+    // Rain Probability Field
+    void buildRainField(const ValueLayer& cloud, const ValueLayer& pressure);
+    bool ensureRainField(LoadContext& ctx);
+    bool writeRainField(const string& path, ostream& log);
+    
+    // Maps
+    bool buildMapView(const MapView& view, string& out, Grid<char>& symbols, ostream& log);
+    
+    // Perimeters, region queries and the weather report
+    void buildCityIndex();
+    void findPerimeter(CellSpan cityPositions, vector<pair<int, int>>& perimeterPositions);
+    void sparsePerimeter(CellSpan cityPositions, vector<pair<int, int>>& perimeterPositions);
+    bool ensureRegionTables(LoadContext& ctx);
+    RegionStats queryRegion(int x1, int x2, int y1, int y2);
+    void cityFootprint(size_t city, CityForecast& forecast, vector<pair<int, int>>& perimeterPositions);
+    CityForecast forecastCity(size_t city);
+    void forecastCities(vector<CityForecast>& forecasts);
+    bool computeWeatherReport(vector<CityForecast>& forecasts, ostream& log);
+    bool buildWeatherReport(string& out, vector<CityForecast>& forecasts, ostream& log);
+    bool streamWeatherReport(OutputBuffer& out, ReportFormat format, ostream& log);
+    
+    // Incremental Updates
+    void buildForecastIndex(ForecastIndex& index);
+    bool ensureForecastIndex(ForecastIndex& index, ostream& log);
+    void applyDelta(ForecastIndex& index, istream& in, int layer, vector<size_t>& affected, ostream& log);
+    bool applyDeltaFile(ForecastIndex& index, const string& fileName, int layer, vector<size_t>& affected, ostream& log);
+
+private:
+    bool ensureLayer(LayerCache& cache, const string& fileName, bool (ForecastEngine::*load)(LoadContext&),
+                     function<void()> clearLayer, LoadContext& ctx);
+    void appendBorder(string& out);
+    template <typename CellFormatter>
+    void renderMap(string& out, const char* title, const char* underline, size_t maxCellChars, CellFormatter formatCell);
+    char* formatCityCell(char* out, int x, int y);
+};
+
+// --------------------------
+// Memory Management Function 
+// --------------------------
+// (Re)size every layer to the configured range. Grids free themselves on exit.
+void ForecastEngine::allocateGrids() {
+    // Calculate new grid dimensions (total columns & rows)
+    grid_width = gridX_max - gridX_min + 1; 
+    grid_height = gridY_max - gridY_min + 1;  
+    
+    cityGrid.reset(grid_width, grid_height, gridX_min, gridY_min);
+    cloudData.reset(grid_width, grid_height, gridX_min, gridY_min);
+    pressureData.reset(grid_width, grid_height, gridX_min, gridY_min);
+}
+
+// Tile cache counters of the out-of-core layers, for sizing --memory-budget
+void ForecastEngine::printTileCacheStats(ostream& log) {
+    const pair<const char*, const ValueLayer*> layers[] = { { "cloud", &cloudData }, { "pressure", &pressureData } };
+    for (const auto& layer : layers) {
+        const TileCache* cache = layer.second->tileCache();
+        if (!cache) continue;
+        
+        TileCacheStats stats = cache->stats();
+        log << "Tile cache (" << layer.first << ", " << (cache->residentBytes() >> 10) << " KB): "
+            << stats.hits << " hits, " << stats.misses << " misses, " << stats.evictions << " evictions, "
+            << stats.writeBacks << " written back, " << stats.prefetched << " prefetched" << endl;
+    }
+}
+
+// How often each layer was served from memory rather than parsed again
+void ForecastEngine::printLayerCacheStats(ostream& log) {
+    const pair<const char*, const LayerCache*> layers[] = {
+        { "city", &cityCache }, { "cloud", &cloudCache }, { "pressure", &pressureCache }
+    };
+    for (const auto& layer : layers) {
+        const LayerCache& cache = *layer.second;
+        if (cache.hits == 0 && cache.misses == 0) continue;
+        log << "Layer cache (" << layer.first << "): " << cache.hits << " hits, " << cache.misses << " misses" << endl;
+    }
+}
+
+// One line per parsed layer: what happened to the lines of its file
+void ForecastEngine::printParseStats(ostream& log) {
+    const struct { const char* kind; const string& fileName; const ParseStats& stats; } layers[] = {
+        { "city", cityFileName, cityParseStats },
+        { "cloud", cloudFileName, cloudParseStats },
+        { "pressure", pressureFileName, pressureParseStats },
+    };
+    for (const auto& layer : layers) {
+        if (layer.fileName.empty() || layer.stats.lines == 0) continue;
+        log << "Parsed " << layer.kind << " data (" << layer.fileName << "): " << layer.stats.lines << " lines, "
+            << layer.stats.stored << " stored, " << layer.stats.skipped << " skipped, " << layer.stats.malformed
+            << " malformed, " << layer.stats.outOfRange << " out of range" << endl;
+    }
+}
+
+// --------------------------
+// Configuration File Reading
+// --------------------------
+// Read the config file line by line into the grid ranges and data file names,
+// then size the grids. Anything the file does not set falls back to the
+// defaults, so configs loaded one after another don't leak into each other.
+// 'echo' prints each line as it is read, as the menu does.
+bool ForecastEngine::loadConfigFile(const string& filename, bool echo, ostream& log) {
+    ifstream file(filename); // Open file for reading
+    if (!file) { // Check if successful or not
+        log << "Error: Cannot open " << filename << endl;
+        return false;
+    }
+    
+    gridX_min = 0; gridX_max = 8;
+    gridY_min = 0; gridY_max = 8;
+    cityFileName = cloudFileName = pressureFileName = "";
+    
     string line;
+    if (echo) cout << "\nReading config file..." << endl;
+   
+   // Read file line by line 
     while (getline(file, line)) {
         line = trim(line);
         if (line.empty()) continue;
         
+        if (echo) cout << line << endl; 
+        
+        // Parse Grid X Range
+        if (line.find("GridX_IdxRange") != string::npos) {
+            size_t colonPos = line.find(':');
+            if (colonPos != string::npos) {
+                string rangeStr = trim(line.substr(colonPos + 1)); // Get part after ::
+                size_t dashPos = rangeStr.find('-');
+                if (dashPos != string::npos) {
+                    try {
+                        string minStr = trim(rangeStr.substr(0, dashPos));
+                        string maxStr = trim(rangeStr.substr(dashPos + 1));
+                        gridX_min = stoi(minStr); // Convert to integer
+                        gridX_max = stoi(maxStr);
+                    } catch (const exception& e) {
+                        log << "Warning: Could not parse GridX_IdxRange" << endl;
+                    }
+                }
+            }
+        }
+        // Parge Grid Y Range
+        else if (line.find("GridY_IdxRange") != string::npos) {
+            size_t colonPos = line.find(':');
+            if (colonPos != string::npos) {
+                string rangeStr = trim(line.substr(colonPos + 1));
+                size_t dashPos = rangeStr.find('-');
+                if (dashPos != string::npos) {
+                    try {
+                        string minStr = trim(rangeStr.substr(0, dashPos));
+                        string maxStr = trim(rangeStr.substr(dashPos + 1));
+                        gridY_min = stoi(minStr);
+                        gridY_max = stoi(maxStr);
+                    } catch (const exception& e) {
+                        log << "Warning: Could not parse GridY_IdxRange" << endl;
+                    }
+                }
+            }
+        }
+        // Identify Data Files
+        else if (line.find("CityLocation.txt") != string::npos) {
+            cityFileName = trim(line);  
+        }
+        else if (line.find("CloudCover.txt") != string::npos) {
+            cloudFileName = trim(line);  
+        }
+        else if (line.find("Pressure.txt") != string::npos) {
+            pressureFileName = trim(line); 
+        }
+    }
+    file.close();
+    
+    // Data file names are relative to the config file, not to the current directory
+    size_t slash = filename.rfind('/');
+    if (slash != string::npos) {
+        string dir = filename.substr(0, slash + 1);
+        for (string* name : { &cityFileName, &cloudFileName, &pressureFileName }) {
+            if (!name->empty() && (*name)[0] != '/') *name = dir + *name;
+        }
+    }
+    
+    // Allocate memory grids based on parsed dimensions
+    allocateGrids();
+    invalidateLayerCaches(); // layers must be re-read into the new grids
+    configLoaded = true; // mark config as loaded
+    return true;
+}
+
+// Encourage user to put in filename and read the file line by line
+void readConfigFile(ForecastEngine& engine) {
+    cout << "Please enter config filename : ";
+    string filename;
+    getline(cin, filename); // Read entire line including spaces
+    
+    filename = trim(filename); // Trim extra whitespaces
+    
+    // A snapshot can be given instead of a config file
+    if (isSnapshotFile(filename)) {
+        if (engine.loadSnapshot(filename, false, cout)) {
+            cout << "\nSnapshot loaded successfully!" << endl;
+            cout << "Grid dimensions: [" << engine.gridX_min << "-" << engine.gridX_max << "] x [" << engine.gridY_min << "-" << engine.gridY_max << "]" << endl;
+            cout << "Cities: " << engine.cities.size() << endl;
+        }
+        waitForEnter();
+        return;
+    }
+    
+    if (!engine.loadConfigFile(filename, true, cout)) {
+        waitForEnter();
+        return;
+    }
+    
+    // Display sumary of what file was loaded
+    cout << "\nConfiguration loaded successfully!" << endl;
+    cout << "Grid dimensions: [" << engine.gridX_min << "-" << engine.gridX_max << "] x [" << engine.gridY_min << "-" << engine.gridY_max << "]" << endl;
+    if (!engine.cityFileName.empty()) cout << "City file: " << engine.cityFileName << endl;
+    if (!engine.cloudFileName.empty()) cout << "Cloud file: " << engine.cloudFileName << endl;  
+    if (!engine.pressureFileName.empty()) cout << "Pressure file: " << engine.pressureFileName << endl;
+    
+    waitForEnter(); 
+}
+
+// --------------------
+// Worker Thread Helper
+// --------------------
+// Number of threads used for parallel work, 0 means one per hardware thread
+unsigned workerThreads = 0;
+
+unsigned workerCount() {
+    unsigned n = workerThreads ? workerThreads : thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+// Largest --threads accepted: a few per hardware thread, enough to try
+// oversubscription without creating workers the machine cannot run
+unsigned maxWorkerThreads() {
+    return max(4 * thread::hardware_concurrency(), 16u);
+}
+
+// ------------------------
+// Work-Stealing Thread Pool
+// ------------------------
+// Persistent workers for parallel loops. A loop of 'count' items is split into
+// one contiguous range per thread; each thread takes small batches from the
+// front of its own range and, once that is empty, steals the back half of
+// the fullest-looking other range. Uneven items (big cities, dense chunks)
+// therefore balance out without a shared counter being hammered.
+//
+// The thread calling run() works as slot 0. Only one loop runs at a time;
+// a loop started from inside a running loop, or while another thread's loop
+// (another engine's) has the pool, simply runs inline rather than waiting.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(unsigned threads) : slots(max(threads, 1u)) {
+        for (size_t slot = 1; slot < slots.size(); slot++) {
+            workers.emplace_back(&WorkStealingPool::workerLoop, this, slot);
+        }
+    }
+
+    ~WorkStealingPool() {
+        {
+            lock_guard<mutex> lock(stateMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (thread& t : workers) t.join();
+    }
+
+    unsigned size() const { return (unsigned)slots.size(); }
+
+    void run(size_t count, const function<void(size_t)>& body) {
+        unique_lock<mutex> job(jobMutex, defer_lock);
+        if (insideLoop || slots.size() == 1 || count <= 1 || !job.try_lock()) {
+            for (size_t i = 0; i < count; i++) body(i);
+            return;
+        }
+        
+        size_t n = slots.size();
+        grain = max<size_t>(1, count / (n * 16));
+        for (size_t slot = 0; slot < n; slot++) {
+            lock_guard<mutex> lock(slots[slot].m);
+            slots[slot].begin = count * slot / n;
+            slots[slot].end = count * (slot + 1) / n;
+        }
+        {
+            lock_guard<mutex> lock(stateMutex);
+            task = &body;
+            failure = nullptr;
+            pending = n;
+            generation++;
+        }
+        wake.notify_all();
+        
+        participate(0);
+        
+        unique_lock<mutex> lock(stateMutex);
+        done.wait(lock, [&] { return pending == 0; });
+        task = nullptr;
+        if (failure) rethrow_exception(failure);
+    }
+
+private:
+    struct Slot {
+        mutex m;
+        size_t begin = 0, end = 0;
+    };
+
+    // Take up to 'grain' items from the front of our own range
+    bool takeOwn(size_t slot, size_t& begin, size_t& end) {
+        lock_guard<mutex> lock(slots[slot].m);
+        Slot& own = slots[slot];
+        if (own.begin == own.end) return false;
+        begin = own.begin;
+        end = min(own.end, own.begin + grain);
+        own.begin = end;
+        return true;
+    }
+
+    // Move the back half of another range into our own
+    bool steal(size_t slot) {
+        size_t n = slots.size();
+        for (size_t k = 1; k < n; k++) {
+            Slot& victim = slots[(slot + k) % n];
+            size_t begin, end;
+            {
+                lock_guard<mutex> lock(victim.m);
+                if (victim.begin == victim.end) continue;
+                size_t mid = victim.begin + (victim.end - victim.begin) / 2;
+                begin = mid;
+                end = victim.end;
+                victim.end = mid;
+            }
+            lock_guard<mutex> lock(slots[slot].m);
+            slots[slot].begin = begin;
+            slots[slot].end = end;
+            return true;
+        }
+        return false;
+    }
+
+    void participate(size_t slot) {
+        insideLoop = true;
+        size_t begin, end;
+        while (takeOwn(slot, begin, end) || (steal(slot) && takeOwn(slot, begin, end))) {
+            try {
+                for (size_t i = begin; i < end; i++) (*task)(i);
+            } catch (...) {
+                lock_guard<mutex> lock(stateMutex);
+                if (!failure) failure = current_exception();
+            }
+        }
+        insideLoop = false;
+        
+        lock_guard<mutex> lock(stateMutex);
+        if (--pending == 0) done.notify_all();
+    }
+
+    void workerLoop(size_t slot) {
+        size_t seen = 0;
+        while (true) {
+            {
+                unique_lock<mutex> lock(stateMutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            participate(slot);
+        }
+    }
+
+    vector<Slot> slots;
+    vector<thread> workers;
+    size_t grain = 1;
+    
+    mutex jobMutex;   // one loop at a time
+    mutex stateMutex; // guards everything below
+    condition_variable wake, done;
+    const function<void(size_t)>* task = nullptr;
+    exception_ptr failure;
+    size_t pending = 0;
+    size_t generation = 0;
+    bool stopping = false;
+    
+    static thread_local bool insideLoop;
+};
+
+thread_local bool WorkStealingPool::insideLoop = false;
+
+unique_ptr<WorkStealingPool> workerPoolPtr;
+mutex workerPoolMutex;
+
+// The shared pool, rebuilt if workerThreads changed since it was made
+WorkStealingPool& workerPool() {
+    lock_guard<mutex> lock(workerPoolMutex);
+    if (!workerPoolPtr || workerPoolPtr->size() != workerCount()) {
+        workerPoolPtr.reset(new WorkStealingPool(workerCount()));
+    }
+    return *workerPoolPtr;
+}
+
+// Run body(0) .. body(count - 1) on the worker pool
+void parallelFor(size_t count, const function<void(size_t)>& body) {
+    workerPool().run(count, body);
+}
+
+// ------------------
+// Memory-Mapped File
+// ------------------
+// Read-only mapping of a whole regular file. open() fails for pipes, ttys and
+// empty files so callers can fall back to streaming with ifstream.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const string& path) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        
+        struct stat info;
+        if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        
+        void* p = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd); // the mapping keeps the file alive
+        if (p == MAP_FAILED) return false;
+        
+        madvise(p, (size_t)info.st_size, MADV_SEQUENTIAL);
+        bytes = static_cast<const char*>(p);
+        length = (size_t)info.st_size;
+        return true;
+    }
+
+    void close() {
+        if (bytes) munmap(const_cast<char*>(bytes), length);
+        bytes = nullptr;
+        length = 0;
+    }
+
+    string_view view() const { return string_view(bytes, length); }
+
+private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+};
+
+// write() all of a buffer, looping if the kernel accepts less
+bool writeAll(int fd, const char* p, size_t left) {
+    while (left > 0) {
+        ssize_t written = ::write(fd, p, left);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += written;
+        left -= (size_t)written;
+    }
+    return true;
+}
+
+// Target size of one parse chunk; small files stay in a single chunk
+const size_t ChunkBytes = 4 << 20;
+
+// Cut text into pieces of roughly chunkBytes that each end just after a newline
+vector<string_view> splitLines(string_view text, size_t chunkBytes) {
+    vector<string_view> chunks;
+    while (!text.empty()) {
+        size_t cut = text.size();
+        if (cut > chunkBytes) {
+            size_t eol = text.find('\n', chunkBytes);
+            cut = (eol == string_view::npos) ? text.size() : eol + 1;
+        }
+        chunks.push_back(text.substr(0, cut));
+        text.remove_prefix(cut);
+    }
+    return chunks;
+}
+
+// ------------
+// Load Context
+// ------------
+// Where a layer load writes its messages, plus a flag it polls so that a
+// failure in another layer loading at the same time can stop it early
+struct LoadContext {
+    explicit LoadContext(ostream& out, const atomic<bool>* stop = nullptr) : log(out), cancel(stop) {}
+    
+    ostream& log;
+    const atomic<bool>* cancel;
+    bool aborted = false; // the load gave up because 'cancel' was raised
+    
+    bool stopRequested() const { return cancel && cancel->load(memory_order_relaxed); }
+    bool abort() {
+        aborted = true;
+        return false;
+    }
+};
+
+// Lines between cancellation checks on the line-by-line paths
+const size_t CancelCheckLines = 4096;
+
+// --------------------------
+// Data File Reading Function
+// --------------------------
+bool ForecastEngine::readCityData(LoadContext& ctx) {
+    if (cityFileName.empty()) {
+        ctx.log << "Error: City filename not found. Please read config file first!" << endl;
+        return false;
+    }
+    
+    ifstream file(cityFileName);
+    if (!file) {
+        ctx.log << "Error: Cannot open " << cityFileName << endl;
+        return false;
+    }
+    
+    cities.clear(); // clear existing city if any
+    cityNames.clear();
+    cityParseStats.clear();
+    
+    string line;
+    string_view trimmed, name;
+    City city;
+    for (size_t n = 1; getline(file, line); n++) {
+        if (n % CancelCheckLines == 0 && ctx.stopRequested()) return ctx.abort();
+        
+        LineStatus status = parseCityLine(line, trimmed, city.x, city.y, city.id, name);
+        if (status == LineStatus::Blank) continue;
+        cityParseStats.lines++;
+        
+        if (status == LineStatus::Skipped) {
+            cityParseStats.skipped++; // Skip malformed lines
+        } else if (status == LineStatus::Malformed) {
+            cityParseStats.malformed++;
+            ctx.log << "Warning: Could not parse line: " << trimmed << endl;
+        } else {
+            city.name = cityNames.intern(name);
+            cities.push_back(city); // Add city to vector
+            cityParseStats.stored++;
+        }
+    }
+    file.close();
+    
+    // Mark cities in grid, sized to fit the largest ID
+    cityGrid.build(cities);
+    buildCityIndex();
+    return true;
+}
+
+bool ForecastEngine::readCityData() {
+    LoadContext ctx(cout);
+    return readCityData(ctx);
+}
+
+// Group the loaded cells by city into 'cityIndex': rank the names, count each
+// city's cells, then drop every cell into its city's slot in file order
+void ForecastEngine::buildCityIndex() {
+    vector<uint32_t>& order = cityIndex.names;
+    order.resize(cityNames.size());
+    for (uint32_t handle = 0; handle < order.size(); handle++) order[handle] = handle;
+    sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return cityNames[a] < cityNames[b]; });
+    vector<uint32_t> rank(order.size());
+    for (uint32_t c = 0; c < order.size(); c++) rank[order[c]] = c;
+    
+    cityIndex.offsets.assign(order.size() + 1, 0);
+    for (const City& city : cities) cityIndex.offsets[rank[city.name] + 1]++;
+    for (size_t c = 0; c < order.size(); c++) cityIndex.offsets[c + 1] += cityIndex.offsets[c];
+    
+    vector<uint32_t> next(cityIndex.offsets.begin(), cityIndex.offsets.end() - 1);
+    cityIndex.ids.assign(order.size(), 0);
+    cityIndex.cells.resize(cities.size());
+    for (const City& city : cities) {
+        uint32_t c = rank[city.name];
+        if (next[c] == cityIndex.offsets[c]) cityIndex.ids[c] = city.id;
+        cityIndex.cells[next[c]++] = { city.x, city.y };
+    }
+}
+
+// Parse and check one raw line of a value layer. True when it holds a value
+// to store; warnings are appended to 'warnings'.
+bool acceptValueLine(string_view raw, const string& kind, ParseStats& stats, string& warnings, int& x, int& y, int& value) {
+    string_view trimmed;
+    LineStatus status = parseValueLine(raw, trimmed, x, y, value);
+    if (status == LineStatus::Blank) return false;
+    stats.lines++;
+    
+    if (status == LineStatus::Skipped) {
+        stats.skipped++; // Skip malformed lines
+        return false;
+    }
+    if (status == LineStatus::Malformed) {
+        stats.malformed++;
+        warnings.append("Warning: Could not parse ").append(kind).append(" data line: ").append(trimmed).append("\n");
+        return false;
+    }
+    
+    // Values are percentages, anything else would not fit the 8-bit layer
+    if (value < 0 || value > 99) {
+        stats.outOfRange++;
+        warnings.append("Warning: Value out of range (0-99) in ").append(kind).append(" data line: ").append(trimmed).append("\n");
+        return false;
+    }
+    stats.stored++;
+    return true;
+}
+
+// Parse one raw line of a value layer and store it. Warnings are appended to
+// 'warnings' so chunks parsed on worker threads can print them in file order.
+void ingestValueLine(string_view raw, const string& kind, ValueLayer::Writer& layer, ParseStats& stats, string& warnings) {
+    int x, y, value;
+    if (!acceptValueLine(raw, kind, stats, warnings, x, y, value)) return;
+    
+    // Store in grid
+    if (layer.containsWorld(x, y)) {
+        layer.setWorld(x, y, (uint8_t)value);
+    }
+}
+
+// Line-at-a-time path, used for pipes, stdin and anything else that can't be mapped
+bool streamValueLayer(istream& file, const string& kind, ValueLayer& layer, ParseStats& stats, LoadContext& ctx) {
+    string line, warnings;
+    ValueLayer::Writer cells(layer);
+    for (size_t n = 1; getline(file, line); n++) {
+        if (n % CancelCheckLines == 0 && ctx.stopRequested()) return ctx.abort();
+        
+        ingestValueLine(line, kind, cells, stats, warnings);
+        if (!warnings.empty()) {
+            ctx.log << warnings << flush;
+            warnings.clear();
+        }
+    }
+    return true;
+}
+
+// Mapped path: split the file into newline-aligned chunks and parse them on
+// the worker threads. Each cell is claimed in a bitmap by the first chunk to
+// store it, so no two threads write the same cell. A cell given more than
+// once is set again afterwards by a pass over the file in line order, which
+// keeps the last line winning as on the line-at-a-time path.
+bool loadValueChunks(const MappedFile& file, const string& kind, ValueLayer& layer, ParseStats& stats, LoadContext& ctx) {
+    vector<string_view> chunks = splitLines(file.view(), ChunkBytes);
+    vector<ParseStats> chunkStats(chunks.size());
+    vector<string> chunkWarnings(chunks.size());
+    vector<atomic<uint64_t>> claimed(chunks.size() > 1 ? (layer.size() + 63) / 64 : 0);
+    vector<vector<size_t>> repeated(chunks.size());
+    
+    auto forEachValue = [&](string_view text, ParseStats& lineStats, string& warnings, auto&& store) {
+        while (!text.empty()) {
+            size_t eol = text.find('\n');
+            string_view raw = text.substr(0, eol);
+            text.remove_prefix(eol == string_view::npos ? text.size() : eol + 1);
+            
+            int x, y, value;
+            if (!acceptValueLine(raw, kind, lineStats, warnings, x, y, value)) continue;
+            if (!layer.containsWorld(x, y)) continue;
+            int gx = x - layer.originX(), gy = y - layer.originY();
+            store(gx, gy, (size_t)gy * layer.width() + gx, (uint8_t)value);
+        }
+    };
+    
+    parallelFor(chunks.size(), [&](size_t i) {
+        if (ctx.stopRequested()) return;
+        
+        ValueLayer::Writer cells(layer);
+        forEachValue(chunks[i], chunkStats[i], chunkWarnings[i], [&](int gx, int gy, size_t cell, uint8_t value) {
+            if (!claimed.empty()) {
+                uint64_t bit = uint64_t(1) << (cell & 63);
+                if (claimed[cell >> 6].fetch_or(bit, memory_order_relaxed) & bit) {
+                    repeated[i].push_back(cell);
+                    return;
+                }
+            }
+            cells.set(gx, gy, value);
+        });
+    });
+    
+    if (ctx.stopRequested()) return ctx.abort();
+    
+    vector<size_t> again;
+    for (const auto& cells : repeated) again.insert(again.end(), cells.begin(), cells.end());
+    if (!again.empty()) {
+        sort(again.begin(), again.end());
+        again.erase(unique(again.begin(), again.end()), again.end());
+        
+        ValueLayer::Writer cells(layer);
+        for (string_view chunk : chunks) {
+            ParseStats ignoredStats;
+            string ignoredWarnings;
+            forEachValue(chunk, ignoredStats, ignoredWarnings, [&](int gx, int gy, size_t cell, uint8_t value) {
+                if (binary_search(again.begin(), again.end(), cell)) cells.set(gx, gy, value);
+            });
+        }
+    }
+    
+    for (size_t i = 0; i < chunks.size(); i++) {
+        stats.add(chunkStats[i]);
+        ctx.log << chunkWarnings[i];
+    }
+    ctx.log << flush;
+    return true;
+}
+
+// Shared reader for the [x, y]-value layers, 'kind' names the layer in messages
+bool readValueLayer(const string& fileName, const string& kind, ValueLayer& layer, ParseStats& stats, LoadContext& ctx) {
+    if (fileName.empty()) {
+        ctx.log << "Error: " << (char)toupper(kind[0]) << kind.substr(1) << " filename not found. Please read config file first!" << endl;
+        return false;
+    }
+    
+    stats.clear();
+    
+    MappedFile mapped;
+    if (mapped.open(fileName)) {
+        return loadValueChunks(mapped, kind, layer, stats, ctx);
+    }
+    
+    ifstream file(fileName);
+    if (!file) {
+        ctx.log << "Error: Cannot open " << fileName << endl;
+        return false;
+    }
+    return streamValueLayer(file, kind, layer, stats, ctx);
+}
+
+bool ForecastEngine::readCloudData(LoadContext& ctx) {
+    return readValueLayer(cloudFileName, "cloud", cloudData, cloudParseStats, ctx);
+}
+
+bool ForecastEngine::readCloudData() {
+    LoadContext ctx(cout);
+    return readCloudData(ctx);
+}
+
+// ---------------------------
+// Read Pressure Data Function
+// ---------------------------
+bool ForecastEngine::readPressureData(LoadContext& ctx) {
+    return readValueLayer(pressureFileName, "pressure", pressureData, pressureParseStats, ctx);
+}
+
+bool ForecastEngine::readPressureData() {
+    LoadContext ctx(cout);
+    return readPressureData(ctx);
+}
+
+// ----------------
+// Layer Load Cache
+// ----------------
+// Each layer remembers the file it was parsed from along with that file's
+// size and modification time (see LayerCache). The display functions go
+// through ensure*Data(), which only re-parses a file when it has changed
+// since the last load.
+
+// Drop every cached layer, e.g. when the grids are reallocated
+void ForecastEngine::invalidateLayerCaches() {
+    cityCache.invalidate();
+    cloudCache.invalidate();
+    pressureCache.invalidate();
+}
+
+// Load 'fileName' with 'load' unless the cache already holds this version of it.
+// Only regular files are cached; pipes and devices are re-read every time.
+bool ForecastEngine::ensureLayer(LayerCache& cache, const string& fileName, bool (ForecastEngine::*load)(LoadContext&),
+                                 function<void()> clearLayer, LoadContext& ctx) {
+    if (cache.pinned || (cache.valid && cache.fromSnapshot)) {
+        cache.hits++;
+        return true;
+    }
+    
+    struct stat info;
+    bool cacheable = !fileName.empty() && stat(fileName.c_str(), &info) == 0 && S_ISREG(info.st_mode);
+    
+    if (cacheable && cache.valid && cache.fileName == fileName && cache.size == info.st_size &&
+        cache.mtime.tv_sec == info.st_mtim.tv_sec && cache.mtime.tv_nsec == info.st_mtim.tv_nsec) {
+        cache.hits++;
+        return true;
+    }
+    
+    cache.misses++;
+    cache.invalidate();
+    if (clearLayer) clearLayer(); // don't keep cells from an older version of the file
+    if (!(this->*load)(ctx)) return false;
+    cache.generation++;
+    
+    if (cacheable) {
+        cache.fileName = fileName;
+        cache.size = info.st_size;
+        cache.mtime = info.st_mtim;
+        cache.valid = true;
+    }
+    return true;
+}
+
+bool ForecastEngine::ensureCityData(LoadContext& ctx) {
+    return ensureLayer(cityCache, cityFileName, &ForecastEngine::readCityData, nullptr, ctx);
+}
+
+bool ForecastEngine::ensureCloudData(LoadContext& ctx) {
+    return ensureLayer(cloudCache, cloudFileName, &ForecastEngine::readCloudData, [this] { cloudData.clear(); }, ctx);
+}
+
+bool ForecastEngine::ensurePressureData(LoadContext& ctx) {
+    return ensureLayer(pressureCache, pressureFileName, &ForecastEngine::readPressureData, [this] { pressureData.clear(); }, ctx);
+}
+
+bool ForecastEngine::ensureCityData() {
+    LoadContext ctx(cout);
+    return ensureCityData(ctx);
+}
+
+bool ForecastEngine::ensureCloudData() {
+    LoadContext ctx(cout);
+    return ensureCloudData(ctx);
+}
+
+bool ForecastEngine::ensurePressureData() {
+    LoadContext ctx(cout);
+    return ensurePressureData(ctx);
+}
+
+// -------------------------
+// Concurrent Layer Loading
+// -------------------------
+// Bring all three layers up to date at once, each on its own thread. Each
+// layer writes its messages to its own buffer and the buffers are printed in
+// city, cloud, pressure order, so the output reads the same as a sequential
+// load. A failed layer cancels only the layers after it, and their messages
+// are dropped: the layers before the first failure and the failed layer itself
+// always run to the end, so what is printed does not depend on timing. Layers
+// after a failure stay uncached, so the next call reloads and reports them.
+bool ForecastEngine::ensureAllData(ostream& log) {
+    bool (ForecastEngine::*const loaders[3])(LoadContext&) = {
+        &ForecastEngine::ensureCityData, &ForecastEngine::ensureCloudData, &ForecastEngine::ensurePressureData
+    };
+    LayerCache* const caches[3] = { &cityCache, &cloudCache, &pressureCache };
+    atomic<bool> cancel[3] = { { false }, { false }, { false } };
+    ostringstream logs[3];
+    bool ok[3] = { false, false, false };
+    size_t generations[3];
+    for (int i = 0; i < 3; i++) generations[i] = caches[i]->generation;
+    
+    vector<thread> threads;
+    for (int i = 0; i < 3; i++) {
+        threads.emplace_back([&, i]() {
+            LoadContext ctx(logs[i], &cancel[i]);
+            ok[i] = (this->*loaders[i])(ctx);
+            if (!ok[i]) {
+                for (int later = i + 1; later < 3; later++) cancel[later] = true;
+            }
+        });
+    }
+    for (thread& t : threads) t.join();
+    
+    int failed = 3;
+    for (int i = 0; i < 3 && failed == 3; i++) {
+        log << logs[i].str();
+        if (!ok[i]) failed = i;
+    }
+    for (int i = failed + 1; i < 3; i++) {
+        if (caches[i]->generation != generations[i]) caches[i]->invalidate();
+    }
+    log << flush;
+    return failed == 3;
+}
+
+// ---------------
+// Binary Snapshot
+// ---------------
+// A snapshot holds everything a config and its three data files produce, so
+// it can be loaded without parsing any text. Layout (native byte order):
+//
+//   SnapshotHeader   magic, version, grid ranges, one entry per section
+//   cloud            packed grid, 1 byte per cell
+//   pressure         packed grid, 1 byte per cell
+//   cities           SnapshotCity records, in file order
+//   city names       the names the records point into, each once
+//
+// Sections start on page boundaries. Loading maps the file copy-on-write and
+// points the grids straight at their sections, so pages are only read when a
+// cell on them is first used. The sparse city ID layer and the city index
+// are rebuilt from the city table. The header, city table and names are always checked against
+// their checksums; the grids only when asked, since that reads every page.
+const char SnapshotMagic[8] = { 'W', 'X', 'S', 'N', 'A', 'P', '\r', '\n' };
+const uint32_t SnapshotVersion = 2; // 1 also stored a dense city ID grid
+const uint32_t SnapshotByteOrder = 0x01020304;
+const uint64_t SnapshotAlignment = 4096;
+
+enum SnapshotSectionId { SectionCloud, SectionPressure, SectionCities, SectionCityNames, SectionCount };
+
+// Element type of a section
+enum SnapshotElement : uint32_t {
+    ElementUInt8 = 1,
+    ElementCity = 16, // SnapshotCity
+    ElementChar = 17
+};
+
+struct SnapshotSection {
+    uint64_t offset;   // from the start of the file
+    uint64_t bytes;
+    uint64_t checksum; // snapshotChecksum() of the bytes
+    uint32_t element;  // SnapshotElement
+    uint32_t reserved;
+};
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t headerBytes;
+    uint32_t sectionCount;
+    int32_t gridX_min, gridX_max;
+    int32_t gridY_min, gridY_max;
+    uint64_t cityCount;
+    SnapshotSection sections[SectionCount];
+    uint64_t headerChecksum; // of the header with this field zero
+};
+
+struct SnapshotCity {
+    int32_t x, y, id;
+    uint32_t nameOffset, nameLength; // into the names section
+};
+
+static_assert(sizeof(SnapshotSection) == 32, "snapshot section must stay packed");
+static_assert(sizeof(SnapshotCity) == 20, "snapshot city record must stay packed");
+
+// FNV-1a over 8-byte words, then the tail bytes. Data can be added in
+// pieces of any size; the result only depends on the bytes.
+class SnapshotHasher {
+public:
+    void add(const void* data, size_t bytes) {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        while (bytes > 0 && pendingBytes > 0) {
+            pending[pendingBytes++] = *p++;
+            bytes--;
+            if (pendingBytes == 8) {
+                mixWord(pending);
+                pendingBytes = 0;
+            }
+        }
+        for (; bytes >= 8; bytes -= 8, p += 8) mixWord(p);
+        memcpy(pending + pendingBytes, p, bytes);
+        pendingBytes += bytes;
+    }
+
+    uint64_t finish() const {
+        uint64_t tail = hash;
+        for (size_t i = 0; i < pendingBytes; i++) {
+            tail = (tail ^ pending[i]) * 1099511628211ull;
+        }
+        return tail;
+    }
+
+private:
+    void mixWord(const unsigned char* p) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+
+    uint64_t hash = 14695981039346656037ull;
+    unsigned char pending[8];
+    size_t pendingBytes = 0;
+};
+
+uint64_t snapshotChecksum(const void* data, size_t bytes) {
+    SnapshotHasher hasher;
+    hasher.add(data, bytes);
+    return hasher.finish();
+}
+
+uint64_t headerChecksum(SnapshotHeader header) {
+    header.headerChecksum = 0;
+    return snapshotChecksum(&header, sizeof(header));
+}
+
+// True when the file starts with the snapshot magic
+bool isSnapshotFile(const string& path) {
+    ifstream file(path, ios::binary);
+    char magic[sizeof(SnapshotMagic)];
+    return file.read(magic, sizeof(magic)) && memcmp(magic, SnapshotMagic, sizeof(magic)) == 0;
+}
+
+// Write the loaded grids and cities. The file is written next to 'path' and
+// renamed over it, so readers never see half a snapshot. Sections are
+// streamed in bands of rows, which also covers out-of-core layers, and the
+// header with the checksums goes in last.
+// Flush the directory holding 'path', so a rename into it survives a crash
+void syncParentDirectory(const string& path) {
+    size_t slash = path.rfind('/');
+    string dir = (slash == string::npos) ? "." : path.substr(0, max(slash, (size_t)1));
+    int dirFd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dirFd >= 0) {
+        fsync(dirFd);
+        ::close(dirFd);
+    }
+}
+
+bool ForecastEngine::writeSnapshot(const string& path, ostream& log) {
+    if (!configLoaded || cityGrid.empty() || cloudData.empty() || pressureData.empty()) {
+        log << "Error: Nothing to write, please read config file first!" << endl;
+        return false;
+    }
+    
+    // City table and the names it points into, each name once
+    string names;
+    vector<uint32_t> nameOffsets(cityNames.size());
+    for (uint32_t handle = 0; handle < cityNames.size(); handle++) {
+        nameOffsets[handle] = (uint32_t)names.size();
+        names += cityNames[handle];
+    }
+    vector<SnapshotCity> records;
+    records.reserve(cities.size());
+    for (const City& city : cities) {
+        records.push_back({ city.x, city.y, city.id, nameOffsets[city.name], (uint32_t)cityNames[city.name].size() });
+    }
+    
+    size_t cells = cloudData.size();
+    const SnapshotSection layout[SectionCount] = {
+        { 0, cells, 0, ElementUInt8, 0 },
+        { 0, cells, 0, ElementUInt8, 0 },
+        { 0, records.size() * sizeof(SnapshotCity), 0, ElementCity, 0 },
+        { 0, names.size(), 0, ElementChar, 0 },
+    };
+    
+    SnapshotHeader header = {};
+    memcpy(header.magic, SnapshotMagic, sizeof(SnapshotMagic));
+    header.version = SnapshotVersion;
+    header.byteOrder = SnapshotByteOrder;
+    header.headerBytes = sizeof(SnapshotHeader);
+    header.sectionCount = SectionCount;
+    header.gridX_min = gridX_min;
+    header.gridX_max = gridX_max;
+    header.gridY_min = gridY_min;
+    header.gridY_max = gridY_max;
+    header.cityCount = records.size();
+    uint64_t offset = sizeof(SnapshotHeader);
+    for (int i = 0; i < SectionCount; i++) {
+        SnapshotSection& section = header.sections[i];
+        section = layout[i];
+        offset = (offset + SnapshotAlignment - 1) / SnapshotAlignment * SnapshotAlignment;
+        section.offset = offset;
+        offset += section.bytes;
+    }
+    
+    // A unique file next to the target, so concurrent writers don't share it
+    // and the rename stays within one file system
+    string tempPath = path + ".XXXXXX";
+    int fd = mkstemp(&tempPath[0]);
+    if (fd < 0) {
+        log << "Error: Cannot create " << tempPath << endl;
+        return false;
+    }
+    fchmod(fd, 0644); // mkstemp makes it private to the owner
+    const char zeros[SnapshotAlignment] = {};
+    uint64_t written = 0;
+    SnapshotHasher hasher;
+    const auto put = [&](const void* data, size_t bytes) {
+        hasher.add(data, bytes);
+        written += bytes;
+        return writeAll(fd, static_cast<const char*>(data), bytes);
+    };
+    const auto putLayer = [&](const ValueLayer& layer) {
+        const int bandRows = 64;
+        vector<uint8_t> scratch;
+        for (int y = 0; y < layer.height(); y += bandRows) {
+            int rows = min(bandRows, layer.height() - y);
+            if (!put(layer.rows(y, rows, scratch), (size_t)rows * layer.width())) return false;
+        }
+        return true;
+    };
+    
+    bool ok = put(zeros, sizeof(header)); // placeholder until the checksums are known
+    for (int i = 0; i < SectionCount && ok; i++) {
+        SnapshotSection& section = header.sections[i];
+        ok = put(zeros, section.offset - written);
+        hasher = SnapshotHasher();
+        if (i == SectionCloud) ok = ok && putLayer(cloudData);
+        else if (i == SectionPressure) ok = ok && putLayer(pressureData);
+        else if (i == SectionCities) ok = ok && put(records.data(), section.bytes);
+        else ok = ok && put(names.data(), section.bytes);
+        section.checksum = hasher.finish();
+    }
+    header.headerChecksum = headerChecksum(header);
+    ok = ok && pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+    ok = ok && fsync(fd) == 0; // the data must be on disk before the name points at it
+    ok = (::close(fd) == 0) && ok;
+    if (!ok || rename(tempPath.c_str(), path.c_str()) != 0) {
+        log << "Error: Could not write snapshot " << path << endl;
+        unlink(tempPath.c_str());
+        return false;
+    }
+    
+    syncParentDirectory(path); // make the rename itself durable
+    return true;
+}
+
+// Map a snapshot and make it the loaded data, as if its config had been read.
+// Nothing is changed unless the whole snapshot checks out.
+bool ForecastEngine::loadSnapshot(const string& path, bool verifyLayers, ostream& log) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        log << "Error: Cannot open " << path << endl;
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || (size_t)info.st_size < sizeof(SnapshotHeader)) {
+        ::close(fd);
+        log << "Error: " << path << " is not a snapshot" << endl;
+        return false;
+    }
+    
+    // Copy-on-write, so the grids stay writable without touching the file
+    size_t fileBytes = (size_t)info.st_size;
+    void* p = mmap(nullptr, fileBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        log << "Error: Cannot map " << path << endl;
+        return false;
+    }
+    shared_ptr<void> mapping(p, [fileBytes](void* q) { munmap(q, fileBytes); });
+    char* base = static_cast<char*>(p);
+    
+    const auto damaged = [&log, &path](const char* what) {
+        log << "Error: Snapshot " << path << " is damaged (" << what << ")" << endl;
+        return false;
+    };
+    
+    SnapshotHeader header;
+    memcpy(&header, base, sizeof(header));
+    if (memcmp(header.magic, SnapshotMagic, sizeof(SnapshotMagic)) != 0) {
+        log << "Error: " << path << " is not a snapshot" << endl;
+        return false;
+    }
+    if (header.version != SnapshotVersion || header.byteOrder != SnapshotByteOrder) {
+        log << "Error: Snapshot " << path << " has unsupported version " << header.version << endl;
+        return false;
+    }
+    if (header.headerBytes != sizeof(SnapshotHeader) || header.sectionCount != SectionCount ||
+        header.headerChecksum != headerChecksum(header)) {
+        return damaged("header");
+    }
+    
+    int64_t width = (int64_t)header.gridX_max - header.gridX_min + 1;
+    int64_t height = (int64_t)header.gridY_max - header.gridY_min + 1;
+    if (width <= 0 || height <= 0 || width > INT_MAX || height > INT_MAX) {
+        return damaged("grid ranges");
+    }
+    uint64_t cells = (uint64_t)width * (uint64_t)height;
+    
+    // Divide rather than multiply: a crafted city count could overflow the product
+    const SnapshotSection* sections = header.sections;
+    if (sections[SectionCities].bytes % sizeof(SnapshotCity) != 0 ||
+        header.cityCount != sections[SectionCities].bytes / sizeof(SnapshotCity)) {
+        return damaged("section table");
+    }
+    const uint64_t expectedBytes[SectionCount] = {
+        cells, cells, sections[SectionCities].bytes, sections[SectionCityNames].bytes
+    };
+    const uint32_t expectedElement[SectionCount] = { ElementUInt8, ElementUInt8, ElementCity, ElementChar };
+    for (int i = 0; i < SectionCount; i++) {
+        const SnapshotSection& section = sections[i];
+        if (section.element != expectedElement[i] || section.bytes != expectedBytes[i] ||
+            section.offset % SnapshotAlignment != 0 || section.offset > fileBytes || section.bytes > fileBytes - section.offset) {
+            return damaged("section table");
+        }
+    }
+    
+    // The city table is read now anyway, so check it; grids only on request
+    for (int i = 0; i < SectionCount; i++) {
+        bool isGrid = (i == SectionCloud || i == SectionPressure);
+        if ((verifyLayers || !isGrid) &&
+            snapshotChecksum(base + sections[i].offset, sections[i].bytes) != sections[i].checksum) {
+            return damaged(i == SectionCities ? "cities" : i == SectionCityNames ? "city names" : "layer checksum");
+        }
+    }
+    
+    const char* names = base + sections[SectionCityNames].offset;
+    uint64_t namesBytes = sections[SectionCityNames].bytes;
+    vector<City> loaded(header.cityCount);
+    CityNames loadedNames;
+    for (uint64_t i = 0; i < header.cityCount; i++) {
+        SnapshotCity record;
+        memcpy(&record, base + sections[SectionCities].offset + i * sizeof(SnapshotCity), sizeof(record));
+        if (record.nameOffset > namesBytes || record.nameLength > namesBytes - record.nameOffset) {
+            return damaged("city names");
+        }
+        loaded[i] = { record.x, record.y, record.id, loadedNames.intern(string_view(names + record.nameOffset, record.nameLength)) };
+    }
+    
+    // Everything checked out, switch over
+    gridX_min = header.gridX_min;
+    gridX_max = header.gridX_max;
+    gridY_min = header.gridY_min;
+    gridY_max = header.gridY_max;
+    grid_width = (int)width;
+    grid_height = (int)height;
+    cityFileName = cloudFileName = pressureFileName = "";
+    
+    cloudData.view(reinterpret_cast<uint8_t*>(base + sections[SectionCloud].offset), grid_width, grid_height, gridX_min, gridY_min, mapping);
+    pressureData.view(reinterpret_cast<uint8_t*>(base + sections[SectionPressure].offset), grid_width, grid_height, gridX_min, gridY_min, mapping);
+    cities = std::move(loaded);
+    cityNames = std::move(loadedNames);
+    cityGrid.reset(grid_width, grid_height, gridX_min, gridY_min);
+    cityGrid.build(cities);
+    buildCityIndex();
+    cityParseStats.clear();
+    cloudParseStats.clear();
+    pressureParseStats.clear();
+    
+    for (LayerCache* cache : { &cityCache, &cloudCache, &pressureCache }) {
+        cache->invalidate();
+        cache->valid = true;
+        cache->fromSnapshot = true;
+        cache->generation++;
+    }
+    configLoaded = true;
+    return true;
+}
+
+// -----------------------------
+// Layer Classification Kernels
+// -----------------------------
+// Turn a whole 0-99 layer into one byte per cell: the index digit
+// ('0' + min(value / 10, 9)) or the L/M/H symbol (below 35 / below 65 /
+// otherwise). Vector versions handle 16 (SSE2, NEON) or 32 (AVX2) cells per
+// step; value / 10 is computed as (value * 205) >> 11, exact for 0-1028.
+// The best kernel for the running CPU is picked on first use.
+enum class CellClass { Index, LMH };
+
+typedef void (*ClassifyKernel)(const uint8_t* src, char* dst, size_t n);
+
+void indexScalar(const uint8_t* src, char* dst, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        int index = src[i] / 10;
+        dst[i] = (char)('0' + (index > 9 ? 9 : index));
+    }
+}
+
+void lmhScalar(const uint8_t* src, char* dst, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = src[i] < 35 ? 'L' : src[i] < 65 ? 'M' : 'H';
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+void indexSSE2(const uint8_t* src, char* dst, size_t n) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mul = _mm_set1_epi16(205);
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i digit0 = _mm_set1_epi8('0');
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), mul), 11);
+        __m128i hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), mul), 11);
+        __m128i index = _mm_min_epu8(_mm_packus_epi16(lo, hi), nine);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_add_epi8(index, digit0));
+    }
+    indexScalar(src + i, dst + i, n - i);
+}
+
+void lmhSSE2(const uint8_t* src, char* dst, size_t n) {
+    // No unsigned byte compare in SSE2: flip the sign bit and compare signed
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    const __m128i below35 = _mm_set1_epi8((char)(35 ^ 0x80));
+    const __m128i below65 = _mm_set1_epi8((char)(65 ^ 0x80));
+    const __m128i L = _mm_set1_epi8('L'), M = _mm_set1_epi8('M'), H = _mm_set1_epi8('H');
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(src + i)), bias);
+        __m128i isLow = _mm_cmplt_epi8(v, below35);
+        __m128i isMid = _mm_andnot_si128(isLow, _mm_cmplt_epi8(v, below65));
+        __m128i isHigh = _mm_andnot_si128(_mm_or_si128(isLow, isMid), _mm_set1_epi8(-1));
+        __m128i out = _mm_or_si128(_mm_or_si128(_mm_and_si128(isLow, L), _mm_and_si128(isMid, M)), _mm_and_si128(isHigh, H));
+        _mm_storeu_si128((__m128i*)(dst + i), out);
+    }
+    lmhScalar(src + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void indexAVX2(const uint8_t* src, char* dst, size_t n) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i mul = _mm256_set1_epi16(205);
+    const __m256i nine = _mm256_set1_epi8(9);
+    const __m256i digit0 = _mm256_set1_epi8('0');
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        // unpack and pack both work per 128-bit lane, so byte order is kept
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i lo = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(v, zero), mul), 11);
+        __m256i hi = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(v, zero), mul), 11);
+        __m256i index = _mm256_min_epu8(_mm256_packus_epi16(lo, hi), nine);
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_add_epi8(index, digit0));
+    }
+    indexSSE2(src + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void lmhAVX2(const uint8_t* src, char* dst, size_t n) {
+    // v < 35 exactly when min(v, 34) == v
+    const __m256i max34 = _mm256_set1_epi8(34), max64 = _mm256_set1_epi8(64);
+    const __m256i L = _mm256_set1_epi8('L'), M = _mm256_set1_epi8('M'), H = _mm256_set1_epi8('H');
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i isLow = _mm256_cmpeq_epi8(_mm256_min_epu8(v, max34), v);
+        __m256i isMidOrLow = _mm256_cmpeq_epi8(_mm256_min_epu8(v, max64), v);
+        __m256i out = _mm256_blendv_epi8(H, M, isMidOrLow);
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_blendv_epi8(out, L, isLow));
+    }
+    lmhSSE2(src + i, dst + i, n - i);
+}
+#endif
+
+#if defined(__aarch64__) || defined(__ARM_NEON)
+void indexNEON(const uint8_t* src, char* dst, size_t n) {
+    const uint8x8_t mul = vdup_n_u8(205);
+    const uint8x16_t nine = vdupq_n_u8(9);
+    const uint8x16_t digit0 = vdupq_n_u8('0');
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8(src + i);
+        uint16x8_t lo = vshrq_n_u16(vmull_u8(vget_low_u8(v), mul), 11);
+        uint16x8_t hi = vshrq_n_u16(vmull_u8(vget_high_u8(v), mul), 11);
+        uint8x16_t index = vminq_u8(vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)), nine);
+        vst1q_u8((uint8_t*)(dst + i), vaddq_u8(index, digit0));
+    }
+    indexScalar(src + i, dst + i, n - i);
+}
+
+void lmhNEON(const uint8_t* src, char* dst, size_t n) {
+    const uint8x16_t below35 = vdupq_n_u8(35), below65 = vdupq_n_u8(65);
+    const uint8x16_t L = vdupq_n_u8('L'), M = vdupq_n_u8('M'), H = vdupq_n_u8('H');
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8(src + i);
+        uint8x16_t out = vbslq_u8(vcltq_u8(v, below65), M, H);
+        vst1q_u8((uint8_t*)(dst + i), vbslq_u8(vcltq_u8(v, below35), L, out));
+    }
+    lmhScalar(src + i, dst + i, n - i);
+}
+#endif
+
+struct ClassifyKernels {
+    const char* name;
+    ClassifyKernel index;
+    ClassifyKernel lmh;
+};
+
+ClassifyKernels pickClassifyKernels() {
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2")) return { "avx2", indexAVX2, lmhAVX2 };
+    if (__builtin_cpu_supports("sse2")) return { "sse2", indexSSE2, lmhSSE2 };
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+    return { "neon", indexNEON, lmhNEON };
+#endif
+    return { "scalar", indexScalar, lmhScalar };
+}
+
+const ClassifyKernels& classifyKernels() {
+    static const ClassifyKernels kernels = pickClassifyKernels();
+    return kernels;
+}
+
+// Classify every cell of 'layer' into 'symbols' (same shape), one row-major pass
+void classifyLayer(const ValueLayer& layer, CellClass kind, Grid<char>& symbols) {
+    symbols.reset(layer.width(), layer.height(), layer.originX(), layer.originY());
+    const ClassifyKernels& kernels = classifyKernels();
+    ClassifyKernel kernel = (kind == CellClass::Index) ? kernels.index : kernels.lmh;
+    
+    // Split into row bands so big layers use every worker
+    const int bandRows = 64;
+    size_t bands = (size_t)(layer.height() + bandRows - 1) / bandRows;
+    parallelFor(bands, [&](size_t band) {
+        int firstRow = (int)band * bandRows;
+        int rows = min(bandRows, layer.height() - firstRow);
+        thread_local vector<uint8_t> scratch;
+        kernel(layer.rows(firstRow, rows, scratch), symbols.row(firstRow), (size_t)rows * layer.width());
+    });
+}
+
+// ----------------------
+// Rain Probability Field
+// ----------------------
+// The report's rain model run on every cell: the cell and its 8 neighbours
+// stand in for a one-cell city and its perimeter, so ACC and AP are the
+// means of the window cells inside the grid, counted the way the report's
+// bounds checks count them. Window sums come from a separable box filter (3
+// across, then 3 down) on 16-bit rows, 16 cells per step with SSE2 or NEON.
+// Symbols are picked on the sums (a mean below 35 is a sum below 35 * cells),
+// so no cell needs a division.
+// Sum of each cell and its left and right neighbours, where it has them
+void boxRow(const uint8_t* in, uint16_t* out, int width) {
+    if (width == 1) {
+        out[0] = in[0];
+        return;
+    }
+    out[0] = in[0] + in[1];
+    int x = 1;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 17 <= width; x += 16) {
+        __m128i left = _mm_loadu_si128((const __m128i*)(in + x - 1));
+        __m128i mid = _mm_loadu_si128((const __m128i*)(in + x));
+        __m128i right = _mm_loadu_si128((const __m128i*)(in + x + 1));
+        __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(left, zero), _mm_unpacklo_epi8(mid, zero)), _mm_unpacklo_epi8(right, zero));
+        __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(left, zero), _mm_unpackhi_epi8(mid, zero)), _mm_unpackhi_epi8(right, zero));
+        _mm_storeu_si128((__m128i*)(out + x), lo);
+        _mm_storeu_si128((__m128i*)(out + x + 8), hi);
+    }
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+    for (; x + 17 <= width; x += 16) {
+        uint8x16_t left = vld1q_u8(in + x - 1), mid = vld1q_u8(in + x), right = vld1q_u8(in + x + 1);
+        vst1q_u16(out + x, vaddw_u8(vaddl_u8(vget_low_u8(left), vget_low_u8(mid)), vget_low_u8(right)));
+        vst1q_u16(out + x + 8, vaddw_u8(vaddl_u8(vget_high_u8(left), vget_high_u8(mid)), vget_high_u8(right)));
+    }
+#endif
+    for (; x < width - 1; x++) {
+        out[x] = in[x - 1] + in[x] + in[x + 1];
+    }
+    out[width - 1] = in[width - 2] + in[width - 1];
+}
+
+// ACC and AP symbols of one window as 3 * acc + ap, with L, M, H = 0, 1, 2
+inline uint8_t rainCode(uint16_t cloudSum, uint16_t pressureSum, uint16_t cells) {
+    uint16_t low = 35 * cells, high = 65 * cells;
+    return 3 * ((cloudSum >= low) + (cloudSum >= high)) + (pressureSum >= low) + (pressureSum >= high);
+}
+
+// One output row from the 3-across sums of the rows above, at and below it.
+// 'rowsIn' is how many of those rows are in the grid; the others are zeros.
+// Interior cells go 16 at a time as codes, which the table turns into
+// probabilities at the end.
+void rainRow(const uint16_t* const cloud[3], const uint16_t* const pressure[3], int rowsIn,
+             const uint8_t table[9], uint8_t* out, int width) {
+    const uint16_t *c0 = cloud[0], *c1 = cloud[1], *c2 = cloud[2];
+    const uint16_t *p0 = pressure[0], *p1 = pressure[1], *p2 = pressure[2];
+    const auto cell = [&](int x, int cols) {
+        out[x] = rainCode(c0[x] + c1[x] + c2[x], p0[x] + p1[x] + p2[x], (uint16_t)(rowsIn * cols));
+    };
+    if (width == 1) {
+        cell(0, 1);
+    } else {
+        cell(0, 2);
+        int x = 1;
+        uint16_t cells = (uint16_t)(rowsIn * 3);
+#if defined(__SSE2__)
+        // Sums are at most 891, so signed compares work; sum > low - 1 is sum >= low
+        const __m128i low = _mm_set1_epi16((short)(35 * cells - 1)), high = _mm_set1_epi16((short)(65 * cells - 1));
+        const auto codes = [&](int i) {
+            __m128i c = _mm_add_epi16(_mm_add_epi16(_mm_loadu_si128((const __m128i*)(c0 + i)), _mm_loadu_si128((const __m128i*)(c1 + i))), _mm_loadu_si128((const __m128i*)(c2 + i)));
+            __m128i p = _mm_add_epi16(_mm_add_epi16(_mm_loadu_si128((const __m128i*)(p0 + i)), _mm_loadu_si128((const __m128i*)(p1 + i))), _mm_loadu_si128((const __m128i*)(p2 + i)));
+            __m128i acc = _mm_add_epi16(_mm_cmpgt_epi16(c, low), _mm_cmpgt_epi16(c, high)); // 0, -1 or -2
+            __m128i ap = _mm_add_epi16(_mm_cmpgt_epi16(p, low), _mm_cmpgt_epi16(p, high));
+            return _mm_sub_epi16(_mm_setzero_si128(), _mm_add_epi16(_mm_add_epi16(acc, _mm_add_epi16(acc, acc)), ap));
+        };
+        for (; x + 17 <= width; x += 16) {
+            _mm_storeu_si128((__m128i*)(out + x), _mm_packus_epi16(codes(x), codes(x + 8)));
+        }
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+        const uint16x8_t low = vdupq_n_u16(35 * cells), high = vdupq_n_u16(65 * cells);
+        const uint16x8_t three = vdupq_n_u16(3);
+        const auto codes = [&](int i) {
+            uint16x8_t c = vaddq_u16(vaddq_u16(vld1q_u16(c0 + i), vld1q_u16(c1 + i)), vld1q_u16(c2 + i));
+            uint16x8_t p = vaddq_u16(vaddq_u16(vld1q_u16(p0 + i), vld1q_u16(p1 + i)), vld1q_u16(p2 + i));
+            uint16x8_t acc = vaddq_u16(vshrq_n_u16(vcgeq_u16(c, low), 15), vshrq_n_u16(vcgeq_u16(c, high), 15));
+            uint16x8_t ap = vaddq_u16(vshrq_n_u16(vcgeq_u16(p, low), 15), vshrq_n_u16(vcgeq_u16(p, high), 15));
+            return vmovn_u16(vmlaq_u16(ap, acc, three));
+        };
+        for (; x + 17 <= width; x += 16) {
+            vst1q_u8(out + x, vcombine_u8(codes(x), codes(x + 8)));
+        }
+#endif
+        for (; x < width - 1; x++) {
+            out[x] = rainCode(c0[x] + c1[x] + c2[x], p0[x] + p1[x] + p2[x], cells);
+        }
+        cell(width - 1, 2);
+    }
+    for (int x = 0; x < width; x++) {
+        out[x] = table[out[x]];
+    }
+}
+
+void ForecastEngine::buildRainField(const ValueLayer& cloud, const ValueLayer& pressure) {
+    int w = cloud.width(), h = cloud.height();
+    rainField.reset(w, h, cloud.originX(), cloud.originY());
+    uint8_t table[9];
+    const char symbols[] = "LMH";
+    for (int acc = 0; acc < 3; acc++) {
+        for (int ap = 0; ap < 3; ap++) {
+            table[3 * acc + ap] = (uint8_t)rainProbabilityFor(symbols[acc], symbols[ap]);
+        }
+    }
+    
+    const int bandRows = 64;
+    size_t bands = (size_t)(h + bandRows - 1) / bandRows;
+    parallelFor(bands, [&](size_t band) {
+        int firstRow = (int)band * bandRows;
+        int rows = min(bandRows, h - firstRow);
+        
+        // 3-across sums of the band plus the row either side, cloud then pressure
+        int top = max(firstRow - 1, 0);
+        int inRows = min(firstRow + rows + 1, h) - top;
+        thread_local vector<uint8_t> scratch;
+        thread_local vector<uint16_t> across, zeros;
+        across.resize((size_t)2 * inRows * w);
+        zeros.assign(w, 0);
+        const uint8_t* cells = cloud.rows(top, inRows, scratch);
+        for (int r = 0; r < inRows; r++) {
+            boxRow(cells + (size_t)r * w, &across[(size_t)r * w], w);
+        }
+        cells = pressure.rows(top, inRows, scratch);
+        for (int r = 0; r < inRows; r++) {
+            boxRow(cells + (size_t)r * w, &across[(size_t)(inRows + r) * w], w);
+        }
+        
+        for (int y = firstRow; y < firstRow + rows; y++) {
+            const uint16_t* cloudRows[3];
+            const uint16_t* pressureRows[3];
+            int rowsIn = 0;
+            for (int dy = -1; dy <= 1; dy++) {
+                bool inGrid = (y + dy >= 0 && y + dy < h);
+                size_t r = (size_t)(y + dy - top);
+                cloudRows[dy + 1] = inGrid ? &across[r * w] : zeros.data();
+                pressureRows[dy + 1] = inGrid ? &across[(inRows + r) * w] : zeros.data();
+                rowsIn += inGrid;
+            }
+            rainRow(cloudRows, pressureRows, rowsIn, table, rainField.row(y), w);
+        }
+    });
+}
+
+// Load both layers and bring the field up to date
+bool ForecastEngine::ensureRainField(LoadContext& ctx) {
+    if (!ensureCloudData(ctx) || !ensurePressureData(ctx)) return false;
+    
+    if (rainBuiltFrom[0] != cloudCache.generation || rainBuiltFrom[1] != pressureCache.generation) {
+        buildRainField(cloudData, pressureData);
+        rainBuiltFrom[0] = cloudCache.generation;
+        rainBuiltFrom[1] = pressureCache.generation;
+    }
+    return true;
+}
+
+// Save the field as a data file in the "[x, y]-value" form of the input
+// layers, row by row from the bottom, so --stream can read it back
+bool ForecastEngine::writeRainField(const string& path, ostream& log) {
+    // Written beside the target and renamed over it, like a snapshot, so a
+    // reader never sees a half-written field
+    string tempPath = path + ".XXXXXX";
+    int fd = mkstemp(&tempPath[0]);
+    if (fd < 0) {
+        log << "Error: Cannot create " << tempPath << endl;
+        return false;
+    }
+    fchmod(fd, 0644);
+    bool ok = true;
+    vector<char> text(32 * (size_t)rainField.width());
+    for (int y = gridY_min; y <= gridY_max && ok; y++) {
+        const uint8_t* row = rainField.row(y - gridY_min);
+        char* p = text.data();
+        for (int x = gridX_min; x <= gridX_max; x++) {
+            *p++ = '[';
+            p = to_chars(p, p + 12, x).ptr;
+            *p++ = ',';
+            *p++ = ' ';
+            p = to_chars(p, p + 12, y).ptr;
+            *p++ = ']';
+            *p++ = '-';
+            p = to_chars(p, p + 3, (int)row[x - gridX_min]).ptr;
+            *p++ = '\n';
+        }
+        ok = writeAll(fd, text.data(), p - text.data());
+    }
+    ok = ok && fsync(fd) == 0;
+    ok = (::close(fd) == 0) && ok;
+    if (!ok || rename(tempPath.c_str(), path.c_str()) != 0) {
+        log << "Error: Could not write " << path << endl;
+        unlink(tempPath.c_str());
+        return false;
+    }
+    syncParentDirectory(path);
+    return true;
+}
+
+// --------------------
+// Map Rendering Engine
+// --------------------
+// Every map view shares the same frame: a title, a '#' border, the Y axis
+// labels down the left (top row is gridY_max) and the X axis labels along
+// the bottom. renderMap() formats the whole map into one pre-sized buffer;
+// each view only supplies a cell formatter that writes the text for one
+// cell, trailing space included, and returns the new end of the buffer.
+
+// Append "# " for every column plus the corner columns
+void ForecastEngine::appendBorder(string& out) {
+    out += "     ";                                       // Space for y-axis labels
+    for (int x = gridX_min - 1; x <= gridX_max; x++) {
+        out += "# ";                                      // Each '#' with space
+    }
+    out += "#\n";                                         // Final '#' for right border
+}
+
+// 'maxCellChars' is the most any single cell can write
+template <typename CellFormatter>
+void ForecastEngine::renderMap(string& out, const char* title, const char* underline, size_t maxCellChars, CellFormatter formatCell) {
+    size_t columns = (size_t)max(grid_width, 0);
+    size_t rows = (size_t)max(grid_height, 0);
+    size_t borderChars = 5 + 2 * (columns + 1) + 2;
+    size_t rowChars = 16 + columns * maxCellChars + 2;
+    size_t labelChars = 8 + columns * 12;
+    out.clear();
+    out.reserve(strlen(title) + strlen(underline) + 4 + 2 * borderChars + rows * rowChars + labelChars);
+    
+    out.append("\n").append(title).append("\n").append(underline).append("\n");
+    appendBorder(out);
+    
+    // Print grid with Y-axis from top to bottom (gridY_max to gridY_min)
+    string rowText(rowChars, ' ');
+    for (int y = gridY_max; y >= gridY_min; y--) {
+        char* p = &rowText[0];
+        
+        // Y-axis label, right-aligned in 3 columns like setw(3), and left border
+        char label[16];
+        char* labelEnd = to_chars(label, label + sizeof(label), y).ptr;
+        for (ptrdiff_t pad = 3 - (labelEnd - label); pad > 0; pad--) *p++ = ' ';
+        p = copy(label, labelEnd, p);
+        p = copy_n("  # ", 4, p);
+        
+        // Grid content with spaces, then right border
+        for (int x = gridX_min; x <= gridX_max; x++) {
+            p = formatCell(p, x, y);
+        }
+        p = copy_n("#\n", 2, p);
+        out.append(rowText.data(), p - rowText.data());
+    }
+    
+    appendBorder(out);
+    
+    // Print X-axis labels at the bottom
+    out += "       ";
+    char label[16];
+    for (int x = gridX_min; x <= gridX_max; x++) {
+        out.append(label, to_chars(label, label + sizeof(label), x).ptr);
+        out += ' ';
+    }
+    out += '\n';
+}
+
+// Send a finished buffer to stdout with a single write(), after flushing
+// whatever cout still holds
+void writeOutput(const string& text) {
+    cout << flush;
+    writeAll(STDOUT_FILENO, text.data(), text.size());
+}
+
+// Cell formatter for the city map, IDs can be several digits wide
+char* ForecastEngine::formatCityCell(char* out, int x, int y) {
+    int id = cityGrid.atWorld(x, y);
+    if (id != 0) {
+        out = to_chars(out, out + 11, id).ptr;
+        *out++ = ' ';
+    } else {
+        *out++ = ' ';
+        *out++ = ' ';
+    }
+    return out;
+}
+
+// ---------
+// Map Views
+// ---------
+// The maps the program can draw: which layer each one needs and how its
+// cells are shown. 'name' is what --map accepts on the command line.
+enum class MapLayer { City, Cloud, Pressure, Rain };
+
+struct MapView {
+    const char* name;
+    const char* title;
+    const char* underline;
+    MapLayer layer;
+    CellClass kind; // unused for the city and rain maps
+};
+
+const MapView mapViews[] = {
+    { "city", "City Map", "--------", MapLayer::City, CellClass::Index },
+    { "cloud-index", "Cloud Coverage Map (Cloudiness Index)", "-------------------------------------", MapLayer::Cloud, CellClass::Index },
+    { "cloud-lmh", "Cloud Coverage Map (LMH symbols)", "---------------------------------", MapLayer::Cloud, CellClass::LMH },
+    { "pressure-index", "Atmospheric Pressure Map (Pressure Index)", "------------------------------------------", MapLayer::Pressure, CellClass::Index },
+    { "pressure-lmh", "Atmospheric Pressure Map (LMH symbols)", "--------------------------------------", MapLayer::Pressure, CellClass::LMH },
+    { "rain", "Rain Probability Map (tens of %)", "--------------------------------", MapLayer::Rain, CellClass::Index },
+};
+
+const MapView* findMapView(const string& name) {
+    for (const MapView& view : mapViews) {
+        if (name == view.name) return &view;
+    }
+    return nullptr;
+}
+
+// Load the view's layer if needed and render it into 'out'. 'symbols' is
+// scratch space for the classified layer, kept by callers that render often.
+bool ForecastEngine::buildMapView(const MapView& view, string& out, Grid<char>& symbols, ostream& log) {
+    LoadContext ctx(log);
+    if (view.layer == MapLayer::City) {
+        if (!ensureCityData(ctx)) return false;
+        renderMap(out, view.title, view.underline, 12, [this](char* p, int x, int y) { return formatCityCell(p, x, y); });
+        return true;
+    }
+    if (view.layer == MapLayer::Rain) {
+        if (!ensureRainField(ctx)) return false;
+        renderMap(out, view.title, view.underline, 2, [this](char* p, int x, int y) {
+            *p++ = (char)('0' + rainField.atWorld(x, y) / 10);
+            *p++ = ' ';
+            return p;
+        });
+        return true;
+    }
+    
+    bool cloud = (view.layer == MapLayer::Cloud);
+    if (!(cloud ? ensureCloudData(ctx) : ensurePressureData(ctx))) return false;
+    
+    // Index and LMH views classify the whole layer first, then just copy symbols
+    classifyLayer(cloud ? cloudData : pressureData, view.kind, symbols);
+    renderMap(out, view.title, view.underline, 2, [&symbols](char* p, int x, int y) {
+        *p++ = symbols.atWorld(x, y);
+        *p++ = ' ';
+        return p;
+    });
+    return true;
+}
+
+// Menu version: check config, draw the map and wait for enter
+void displayMapView(ForecastEngine& engine, const MapView& view) {
+    if (!engine.configLoaded) {
+        cout << "Please read config file first!" << endl;
+        waitForEnter();
+        return;
+    }
+    
+    string text;
+    Grid<char> symbols;
+    if (engine.buildMapView(view, text, symbols, cout)) {
+        writeOutput(text);
+    }
+    
+    waitForEnter();
+}
+
+// -------------------------
+// Display City Map Function
+// -------------------------
+void displayCityMap(ForecastEngine& engine) {
+    displayMapView(engine, mapViews[0]);
+}
+
+// ----------------------------
+// Display Cloud Coverage Index
+// ----------------------------
+// Shows cloud coverage as index values
+void displayCloudCoverageIndex(ForecastEngine& engine) {
+    displayMapView(engine, mapViews[1]);
+}
+
+// -----------------------------------
+// Display Cloud Coverage LMH Function
+// -----------------------------------
+// Shows cloud coverage as Low/Medium/High symbols
+void displayCloudCoverageLMH(ForecastEngine& engine) {
+    displayMapView(engine, mapViews[2]);
+}
+
+// -------------------------------
+// Display Pressure Index Function
+// -------------------------------
+// Shows atmospheric pressure as index values (0-9)
+void displayPressureIndex(ForecastEngine& engine) {
+    displayMapView(engine, mapViews[3]);
+}
+
+// -----------------------------
+// Display Pressure LMH Function
+// -----------------------------
+// Shows atmospheric pressure as Low/Medium/High symbols
+void displayPressureLMH(ForecastEngine& engine) {
+    displayMapView(engine, mapViews[4]);
+}
+
+// ---------------------------------
+// Display Rain Probability Function
+// ---------------------------------
+// Shows every cell's rain probability as if it were a one-cell city (1-9 = 10-90%)
+void displayRainProbability(ForecastEngine& engine) {
+    displayMapView(engine, mapViews[5]);
+}
+
+// -------------
+// Bit Mask Type
+// -------------
+// One bit per cell, 64 cells per word, rows padded to a multiple of four
+// words so every row starts on a 32-byte boundary. Bit x of a row lives in
+// word x / 64 at bit x % 64. Dilation, subtraction and counting work on
+// whole words, so a row of 4096 cells is 64 operations instead of 4096.
+class BitMask {
+public:
+    // Size to width x height cells with (originX, originY) as world coordinate of bit [0][0]
+    void reset(int width, int height, int originX, int originY) {
+        w = max(width, 0);
+        h = max(height, 0);
+        x0 = originX;
+        y0 = originY;
+        stride = ((w + 255) / 256) * 4;
+        bits.reset(stride, h, 0, 0);
+    }
+
+    int width() const { return w; }
+    int height() const { return h; }
+
+    bool containsWorld(int x, int y) const {
+        return x - x0 >= 0 && x - x0 < w && y - y0 >= 0 && y - y0 < h;
+    }
+    void set(int x, int y) {
+        int gx = x - x0;
+        bits.at(gx >> 6, y - y0) |= uint64_t(1) << (gx & 63);
+    }
+    bool test(int x, int y) const {
+        int gx = x - x0;
+        return (bits.at(gx >> 6, y - y0) >> (gx & 63)) & 1;
+    }
+
+    // out = this grown by 'radius' cells in all 8 directions (a square
+    // structuring element). Done separably: rows first, then columns, each
+    // by doubling the reach so the cost grows with log(radius).
+    void dilate(int radius, BitMask& out) const {
+        out.reset(w, h, x0, y0);
+        if (w == 0 || h == 0) return;
+        
+        vector<uint64_t> row(stride);
+        for (int y = 0; y < h; y++) {
+            const uint64_t* src = bits.row(y);
+            uint64_t* dst = out.bits.row(y);
+            copy(src, src + stride, dst);
+            for (int reach = 0; reach < radius; ) {
+                int step = min({reach + 1, radius - reach, 63});
+                copy(dst, dst + stride, row.begin());
+                for (int i = 0; i < stride; i++) {
+                    uint64_t left = (row[i] << step) | (i > 0 ? row[i - 1] >> (64 - step) : 0);
+                    uint64_t right = (row[i] >> step) | (i + 1 < stride ? row[i + 1] << (64 - step) : 0);
+                    dst[i] = row[i] | left | right;
+                }
+                reach += step;
+            }
+            clearPadding(dst);
+        }
+        
+        Grid<uint64_t> band;
+        for (int reach = 0; reach < radius; ) {
+            int step = min(reach + 1, radius - reach);
+            band.reset(stride, h, 0, 0);
+            copy(out.bits.data(), out.bits.data() + out.bits.size(), band.data());
+            for (int y = 0; y < h; y++) {
+                uint64_t* dst = out.bits.row(y);
+                if (y - step >= 0) {
+                    const uint64_t* below = band.row(y - step);
+                    for (int i = 0; i < stride; i++) dst[i] |= below[i];
+                }
+                if (y + step < h) {
+                    const uint64_t* above = band.row(y + step);
+                    for (int i = 0; i < stride; i++) dst[i] |= above[i];
+                }
+            }
+            reach += step;
+        }
+    }
+
+    // Clear every bit that is set in 'other' (same shape)
+    void subtract(const BitMask& other) {
+        uint64_t* dst = bits.data();
+        const uint64_t* src = other.bits.data();
+        for (size_t i = 0, n = bits.size(); i < n; i++) dst[i] &= ~src[i];
+    }
+
+    size_t count() const {
+        size_t total = 0;
+        const uint64_t* src = bits.data();
+        for (size_t i = 0, n = bits.size(); i < n; i++) total += __builtin_popcountll(src[i]);
+        return total;
+    }
+
+    // Call f(x, y) in world coordinates for every set bit, row by row
+    template <typename F>
+    void forEachSet(F f) const {
+        for (int y = 0; y < h; y++) {
+            const uint64_t* src = bits.row(y);
+            for (int i = 0; i < stride; i++) {
+                for (uint64_t word = src[i]; word; word &= word - 1) {
+                    f(x0 + i * 64 + __builtin_ctzll(word), y0 + y);
+                }
+            }
+        }
+    }
+
+private:
+    // Bits past the last column must stay zero or they would leak into counts
+    void clearPadding(uint64_t* row) const {
+        int full = w >> 6;
+        if (full < stride) {
+            if (w & 63) row[full++] &= (uint64_t(1) << (w & 63)) - 1;
+            for (int i = full; i < stride; i++) row[i] = 0;
+        }
+    }
+
+    Grid<uint64_t> bits;
+    int w = 0, h = 0, x0 = 0, y0 = 0;
+    int stride = 0; // words per row
+};
+
+// ----------------------
+// City Perimeter Search
+// ----------------------
+// The perimeter of a city is every in-grid cell within 'perimeterRadius' of
+// one of its cells (8-directional) that is not itself a city cell: the city
+// mask dilated by the radius, minus the city mask. The masks only cover the
+// city's bounding box, so the cost is proportional to its area / 64. A city
+// whose cells are scattered (one name at opposite corners of the grid) would
+// need masks far larger than the city, so when the box holds more than
+// SparsePerimeterRatio times the cells the rings could cover, its cells are
+// listed and sorted instead, at a cost that follows the cell count.
+const long long SparsePerimeterRatio = 64;
+
+// Row-major (y, then x) order, the order BitMask::forEachSet visits cells in
+bool rowMajorLess(const pair<int, int>& a, const pair<int, int>& b) {
+    return a.second != b.second ? a.second < b.second : a.first < b.first;
+}
+
+void ForecastEngine::sparsePerimeter(CellSpan cityPositions, vector<pair<int, int>>& perimeterPositions) {
+    thread_local vector<pair<int, int>> city;
+    const int r = perimeterRadius;
+    perimeterPositions.clear();
+    city.assign(cityPositions.begin(), cityPositions.end());
+    sort(city.begin(), city.end(), rowMajorLess);
+    
+    // Every in-grid cell of every ring, then duplicates and city cells out
+    for (const auto& pos : city) {
+        if (pos.first < gridX_min - r || pos.first > gridX_max + r || pos.second < gridY_min - r || pos.second > gridY_max + r) continue;
+        for (int y = max(pos.second - r, gridY_min); y <= min(pos.second + r, gridY_max); y++) {
+            for (int x = max(pos.first - r, gridX_min); x <= min(pos.first + r, gridX_max); x++) {
+                perimeterPositions.push_back({x, y});
+            }
+        }
+    }
+    sort(perimeterPositions.begin(), perimeterPositions.end(), rowMajorLess);
+    perimeterPositions.erase(unique(perimeterPositions.begin(), perimeterPositions.end()), perimeterPositions.end());
+    
+    auto cityCell = city.begin();
+    auto kept = perimeterPositions.begin();
+    for (const auto& pos : perimeterPositions) {
+        while (cityCell != city.end() && rowMajorLess(*cityCell, pos)) ++cityCell;
+        if (cityCell == city.end() || *cityCell != pos) *kept++ = pos;
+    }
+    perimeterPositions.erase(kept, perimeterPositions.end());
+}
+
+void ForecastEngine::findPerimeter(CellSpan cityPositions, vector<pair<int, int>>& perimeterPositions) {
+    thread_local BitMask cityMask, ringMask;
+    const int r = perimeterRadius;
+    perimeterPositions.clear();
+    
+    // Bounding box of the cells close enough to the grid to have an in-grid neighbour
+    int minX = INT_MAX, minY = INT_MAX, maxX = INT_MIN, maxY = INT_MIN;
+    auto reachesGrid = [&](const pair<int, int>& pos) {
+        return pos.first >= gridX_min - r && pos.first <= gridX_max + r &&
+               pos.second >= gridY_min - r && pos.second <= gridY_max + r;
+    };
+    for (const auto& pos : cityPositions) {
+        if (!reachesGrid(pos)) continue;
+        minX = min(minX, pos.first);
+        maxX = max(maxX, pos.first);
+        minY = min(minY, pos.second);
+        maxY = max(maxY, pos.second);
+    }
+    if (minX > maxX) return;
+    
+    long long side = 2LL * r + 1;
+    long long boxArea = (maxX - minX + side) * (long long)(maxY - minY + side);
+    if (boxArea > SparsePerimeterRatio * side * side * (long long)cityPositions.size()) {
+        sparsePerimeter(cityPositions, perimeterPositions);
+        return;
+    }
+    
+    // Mark the city itself, with room for the ring around it
+    cityMask.reset(maxX - minX + 1 + 2 * r, maxY - minY + 1 + 2 * r, minX - r, minY - r);
+    for (const auto& pos : cityPositions) {
+        if (reachesGrid(pos)) cityMask.set(pos.first, pos.second);
+    }
+    
+    cityMask.dilate(r, ringMask);
+    ringMask.subtract(cityMask);
+    
+    // Keep only ring cells within grid bounds
+    ringMask.forEachSet([&](int x, int y) {
+        if (x >= gridX_min && x <= gridX_max && y >= gridY_min && y <= gridY_max) {
+            perimeterPositions.push_back({x, y});
+        }
+    });
+}
+
+// ------------------
+// Layer Accumulation
+// ------------------
+// Running totals of N layers over a set of cells. All layers share the grid
+// shape, so one bounds check per cell covers every layer.
+template <size_t N>
+struct LayerSums {
+    long long total[N] = {};
+    int cells = 0; // cells that were inside the grid
+};
+
+// Add every in-grid cell of 'positions' to 'sums' in a single traversal,
+// reading all N layers at each cell while it is hot in cache. Adding a layer
+// (humidity, temperature, ...) widens N instead of adding another pass.
+template <size_t N>
+void accumulateLayers(const array<const ValueLayer*, N>& layers, CellSpan positions, LayerSums<N>& sums) {
+    const ValueLayer& shape = *layers[0];
+    array<ValueLayer::Reader, N> readers;
+    for (size_t i = 0; i < N; i++) readers[i].open(*layers[i]);
+    for (const auto& pos : positions) {
+        // checking boundaries before accessing
+        if (!shape.containsWorld(pos.first, pos.second)) continue;
+        
+        int gx = pos.first - shape.originX();
+        int gy = pos.second - shape.originY();
+        for (size_t i = 0; i < N; i++) {
+            sums.total[i] += readers[i].at(gx, gy);
+        }
+        sums.cells++;
+    }
+}
+
+// --------------
+// Region Queries
+// --------------
+// Sum, mean and cell count of the cloud and pressure layers over any
+// rectangle in constant time, from a summed-area table per layer (see
+// SummedAreaTable). A table is built on the first query after its layer is
+// (re)loaded.
+struct RegionStats {
+    int x1, x2, y1, y2;   // the rectangle after clipping to the grid
+    size_t cells = 0;
+    uint64_t sum[2] = {}; // cloud, pressure
+    double mean[2] = {};
+};
+
+// Load both layers and bring their tables up to date
+bool ForecastEngine::ensureRegionTables(LoadContext& ctx) {
+    if (!ensureCloudData(ctx) || !ensurePressureData(ctx)) return false;
+    
+    if (cloudSums.builtFrom != cloudCache.generation) {
+        cloudSums.build(cloudData);
+        cloudSums.builtFrom = cloudCache.generation;
+    }
+    if (pressureSums.builtFrom != pressureCache.generation) {
+        pressureSums.build(pressureData);
+        pressureSums.builtFrom = pressureCache.generation;
+    }
+    return true;
+}
+
+// [x1..x2] x [y1..y2] in world coordinates, either way round. Only cells
+// inside the grid count, as with the bounds checks in the report.
+RegionStats ForecastEngine::queryRegion(int x1, int x2, int y1, int y2) {
+    RegionStats stats;
+    stats.x1 = max(min(x1, x2), gridX_min);
+    stats.x2 = min(max(x1, x2), gridX_max);
+    stats.y1 = max(min(y1, y2), gridY_min);
+    stats.y2 = min(max(y1, y2), gridY_max);
+    if (stats.x1 > stats.x2 || stats.y1 > stats.y2) return stats;
+    
+    int gx1 = stats.x1 - gridX_min, gx2 = stats.x2 - gridX_min;
+    int gy1 = stats.y1 - gridY_min, gy2 = stats.y2 - gridY_min;
+    stats.cells = (size_t)(gx2 - gx1 + 1) * (size_t)(gy2 - gy1 + 1);
+    stats.sum[0] = cloudSums.sum(gx1, gx2, gy1, gy2);
+    stats.sum[1] = pressureSums.sum(gx1, gx2, gy1, gy2);
+    for (int i = 0; i < 2; i++) {
+        stats.mean[i] = (double)stats.sum[i] / stats.cells;
+    }
+    return stats;
+}
+
+// Shows the part of the region inside the grid
+void printRegion(ostream& out, const RegionStats& stats) {
+    if (stats.cells == 0) {
+        out << "\nNo grid cells in this region\n";
+        return;
+    }
+    out << "\nRegion [" << stats.x1 << "-" << stats.x2 << "] x [" << stats.y1 << "-" << stats.y2 << "]\n";
+    out << "Cells : " << stats.cells << "\n";
+    out << "Cloud Cover : sum " << stats.sum[0] << ", mean " << fixed << setprecision(2) << stats.mean[0] << "\n";
+    out << "Pressure : sum " << stats.sum[1] << ", mean " << fixed << setprecision(2) << stats.mean[1] << "\n";
+}
+
+// "x1,x2,y1,y2" as used by --region
+bool parseRegion(const string& text, array<int, 4>& region) {
+    string_view rest = text;
+    for (int i = 0; i < 4; i++) {
+        size_t comma = rest.find(',');
+        if ((i < 3) == (comma == string_view::npos)) return false;
+        if (!parseIntField(rest.substr(0, comma), region[i])) return false;
+        rest.remove_prefix(i < 3 ? comma + 1 : rest.size());
+    }
+    return true;
+}
+
+// ------------------------
+// City Forecast Computation
+// ------------------------
+// Forecast for one city, as shown in the summary report
+struct CityForecast {
+    string_view name; // into the dataset's CityNames
+    int id = 0;
+    double acc = 0, ap = 0;
+    char accSymbol = 'L', apSymbol = 'L';
+    int rainProbability = 50;
+    size_t cityCells = 0, perimeterCells = 0;
+};
+
+// Probability of rain from the ACC and AP symbols (table in Appendix E)
+int rainProbabilityFor(char accSymbol, char apSymbol) {
+    // Lookup probability of rain based on the table in Appendix E
+    int rainProbability = 50; // Default
+    
+    if (accSymbol == 'H' && apSymbol == 'L') {
+        rainProbability = 90;
+    }
+    else if (accSymbol == 'M' && apSymbol == 'L') {
+        rainProbability = 80;
+    }
+    else if (accSymbol == 'L' && apSymbol == 'L') {
+        rainProbability = 70;
+    }
+    else if (accSymbol == 'H' && apSymbol == 'M') {
+        rainProbability = 60;
+    }
+    else if (accSymbol == 'M' && apSymbol == 'M') {
+        rainProbability = 50;
+    }
+    else if (accSymbol == 'L' && apSymbol == 'M') {
+        rainProbability = 40;
+    }
+    else if (accSymbol == 'H' && apSymbol == 'H') {
+        rainProbability = 30;
+    }
+    else if (accSymbol == 'M' && apSymbol == 'H') {
+        rainProbability = 20;
+    }
+    else if (accSymbol == 'L' && apSymbol == 'H') {
+        rainProbability = 10;
+    }
+    
+    return rainProbability;
+}
+
+// Name, ID and cell counts of city 'city' of the city index, and its
+// perimeter cells; its own cells are cityIndex.cellsOf(city)
+void ForecastEngine::cityFootprint(size_t city, CityForecast& forecast, vector<pair<int, int>>& perimeterPositions) {
+    CellSpan cityPositions = cityIndex.cellsOf(city);
+    forecast.name = cityNames[cityIndex.names[city]];
+    forecast.id = cityIndex.ids[city];
+    
+    // Find surrounding (perimeter) areas - 8-directional neighbors
+    findPerimeter(cityPositions, perimeterPositions);
+    forecast.cityCells = cityPositions.size();
+    forecast.perimeterCells = perimeterPositions.size();
+}
+
+// ACC, AP, their symbols and the rain probability from the summed cloud
+// (total[0]) and pressure (total[1]) values
+void finishForecast(CityForecast& forecast, const LayerSums<2>& sums) {
+    // Calculate ACC (Average Cloud Cover) and AP (Average Pressure), checking div by 0
+    forecast.acc = (sums.cells > 0) ? (double)sums.total[0] / sums.cells : 0;
+    forecast.ap = (sums.cells > 0) ? (double)sums.total[1] / sums.cells : 0;
+    
+    // Determine LMH symbols for ACC and AP
+    forecast.accSymbol = (forecast.acc < 35) ? 'L' : (forecast.acc < 65) ? 'M' : 'H';
+    forecast.apSymbol = (forecast.ap < 35) ? 'L' : (forecast.ap < 65) ? 'M' : 'H';
+    forecast.rainProbability = rainProbabilityFor(forecast.accSymbol, forecast.apSymbol);
+}
+
+CityForecast ForecastEngine::forecastCity(size_t city) {
+    CityForecast forecast;
+    thread_local vector<pair<int, int>> perimeterPositions; // reused, nothing is allocated per city
+    cityFootprint(city, forecast, perimeterPositions);
+    
+    // Sum cloud and pressure over city and perimeter areas in one pass per list
+    const array<const ValueLayer*, 2> reportLayers = { &cloudData, &pressureData };
+    LayerSums<2> sums;
+    accumulateLayers(reportLayers, cityIndex.cellsOf(city), sums);
+    accumulateLayers(reportLayers, perimeterPositions, sums);
+    
+    finishForecast(forecast, sums);
+    return forecast;
+}
+
+// Every city is independent, so they are spread over the worker pool.
+// forecasts[i] always belongs to city i of the city index, whatever thread
+// computed it.
+void ForecastEngine::forecastCities(vector<CityForecast>& forecasts) {
+    forecasts.assign(cityIndex.size(), CityForecast());
+    parallelFor(cityIndex.size(), [&](size_t i) {
+        forecasts[i] = forecastCity(i);
+    });
+}
+
+void printForecast(ostream& out, const CityForecast& forecast) {
+    // Display city report
+    out << "\nCity Name : " << forecast.name << '\n';
+    out << "City ID : " << forecast.id << '\n';
+    out << "Ave. Cloud Cover (ACC) : " << fixed << setprecision(2) << forecast.acc << " (" << forecast.accSymbol << ")" << '\n';
+    out << "Ave. Pressure (AP) : " << fixed << setprecision(2) << forecast.ap << " (" << forecast.apSymbol << ")" << '\n';
+    out << "Probability of Rain (%) : " << fixed << setprecision(2) << (double)forecast.rainProbability << '\n';
+    
+    // ASCII graphics from second code - but with safety
+    if (forecast.rainProbability == 90) {
+        out << "" << '\n';                 // 40% base
+        out << "~" << '\n';                // Separator (5 tildes)
+        out << "\\\\\\\\\\" << '\n';          // 50% extra (5 backslashes)
+    }
+    else if (forecast.rainProbability == 80) {
+        out << "" << '\n';                 // 40% base
+        out << "~" << '\n';                // Separator
+        out << "\\\\\\\\" << '\n';            // 40% extra (4 backslashes)
+    }
+    else if (forecast.rainProbability == 70) {
+        out << "" << '\n';                 // 40% base
+        out << "~" << '\n';                // Separator
+        out << "\\\\\\" << '\n';              // 30% extra (3 backslashes)
+    }
+    else if (forecast.rainProbability == 60) {
+        out << "" << '\n';                 // 40% base
+        out << "~" << '\n';                // Separator
+        out << "\\\\" << '\n';                // 20% extra (2 backslashes)
+    }
+    else if (forecast.rainProbability == 50) {
+        out << "" << '\n';                 // 40% base
+        out << "~" << '\n';                // Separator
+        out << "\\" << '\n';                  // 10% extra (1 backslash)
+    }
+    else if (forecast.rainProbability == 40) {
+        out << "" << '\n';                 // 40% base
+        out << "~" << '\n';                // Separator
+        // No extra (40% total)
+    }
+    else if (forecast.rainProbability == 30) {
+        out << "~" << '\n';                  // 30% total (3 tildes)
+        out << "" << '\n';                 // Separator (base + 1)
+    }
+    else if (forecast.rainProbability == 20) {
+        out << "" << '\n';                   // 20% total (2 tildes)
+        out << "~" << '\n';                  // Separator (base + 1)
+    }
+    else if (forecast.rainProbability == 10) {
+        out << "~" << '\n';                    // 10% total (1 tilde)
+        out << "" << '\n';                   // Separator (base + 1)
+    }
+}
+
+// -------------------------------
+// Display Weather Report Function
+// -------------------------------
+// Load all three layers and compute the forecast for every city, in name
+// order. The forecasts' names are valid until the cities are loaded again.
+bool ForecastEngine::computeWeatherReport(vector<CityForecast>& forecasts, ostream& log) {
+    // checking data integrity
+    if (cityGrid.empty() || cloudData.empty() || pressureData.empty()) {
+        log << "Error: Grid data not allocated!" << endl;
+        return false;
+    }
+    
+    // Load all data
+    if (!ensureAllData(log)) {
+        return false;
+    }
+    
+    // Compute every city in parallel, then print in name order; the city
+    // index already groups multi-cell cities by name
+    forecastCities(forecasts);
+    return true;
+}
+
+// Shows detailed weather forecast for each city. The text is built into 'out'
+// once all three layers are loaded.
+bool ForecastEngine::buildWeatherReport(string& out, vector<CityForecast>& forecasts, ostream& log) {
+    if (!computeWeatherReport(forecasts, log)) {
+        return false;
+    }
+    
+    ostringstream text;
+    text << "\nWeather Forecast Summary Report\n";
+    text << "===============================\n";
+    for (const CityForecast& forecast : forecasts) {
+        printForecast(text, forecast);
+    }
+    out = text.str();
+    return true;
+}
+
+void displayWeatherReport(ForecastEngine& engine) {
+    if (!engine.configLoaded) {
+        cout << "Please read config file first!" << endl;
+        waitForEnter();
+        return;
+    }
+    
+    string text;
+    vector<CityForecast> forecasts;
+    if (engine.buildWeatherReport(text, forecasts, cout)) {
+        writeOutput(text);
+    }
+    
+    waitForEnter();
+}
+
+// -----------------------------
+// Display Region Query Function
+// -----------------------------
+// Shows cloud and pressure totals and averages over a rectangle
+void displayRegionQuery(ForecastEngine& engine) {
+    if (!engine.configLoaded) {
+        cout << "Please read config file first!" << endl;
+        waitForEnter();
+        return;
+    }
+    
+    cout << "Please enter region x1 x2 y1 y2 : ";
+    string input;
+    getline(cin, input);
+    istringstream fields(input);
+    int x1, x2, y1, y2;
+    if (!(fields >> x1 >> x2 >> y1 >> y2)) {
+        cout << "Invalid region! Please enter four whole numbers." << endl;
+        waitForEnter();
+        return;
+    }
+    
+    LoadContext ctx(cout);
+    if (engine.ensureRegionTables(ctx)) {
+        printRegion(cout, engine.queryRegion(x1, x2, y1, y2));
+    }
+    
+    waitForEnter();
+}
+
+// --------------
+// Report Records
+// --------------
+// The report as one record per city for other programs to read: JSON Lines
+// (one object per line) or CSV with a header row. Records are formatted with
+// to_chars straight into an OutputBuffer, so nothing is allocated per city.
+enum class ReportFormat : int { Text, JsonLines, Csv };
+
+bool parseReportFormat(const string& name, ReportFormat& format) {
+    if (name == "text") format = ReportFormat::Text;
+    else if (name == "jsonl") format = ReportFormat::JsonLines;
+    else if (name == "csv") format = ReportFormat::Csv;
+    else return false;
+    return true;
+}
+
+// Fixed-size output buffer written to a file descriptor whenever it fills
+class OutputBuffer {
+public:
+    explicit OutputBuffer(int fd, size_t capacity = 1 << 16) : fd(fd), buffer(capacity) {}
+    ~OutputBuffer() { flush(); }
+    
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+    
+    // Make room for 'n' bytes (n <= capacity) and return where they go;
+    // hand the end of what was written back to commit()
+    char* reserve(size_t n) {
+        if (buffer.size() - used < n) flush();
+        return buffer.data() + used;
+    }
+    void commit(char* end) { used = end - buffer.data(); }
+    
+    void append(string_view text) {
+        if (buffer.size() - used < text.size()) {
+            flush();
+            if (text.size() > buffer.size()) { // too big to buffer, write it through
+                ok = ok && writeAll(fd, text.data(), text.size());
+                return;
+            }
+        }
+        memcpy(buffer.data() + used, text.data(), text.size());
+        used += text.size();
+    }
+    void put(char c) { *reserve(1) = c; used++; }
+    
+    // CSV records go in tables that start with a header row. The header is
+    // written before a record unless the record before it had the same one,
+    // so a run that writes no records writes no header either;
+    // newCsvTable() makes the next record start a table again.
+    void csvRecord(const char* header) {
+        if (header == csvHeader) return;
+        append(header);
+        csvHeader = header;
+    }
+    void newCsvTable() { csvHeader = nullptr; }
+    
+    bool flush() {
+        ok = ok && writeAll(fd, buffer.data(), used);
+        used = 0;
+        return ok;
+    }
+    bool failed() const { return !ok; }
+    
+private:
+    int fd;
+    vector<char> buffer;
+    size_t used = 0;
+    bool ok = true;
+    const char* csvHeader = nullptr; // header of the current CSV table
+};
+
+// Name as a JSON string; runs of plain characters are copied in one go
+void appendJsonString(OutputBuffer& out, string_view text) {
+    out.put('"');
+    size_t start = 0;
+    for (size_t i = 0; i < text.size(); i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+        
+        out.append(text.substr(start, i - start));
+        start = i + 1;
+        char* p = out.reserve(6);
+        *p++ = '\\';
+        switch (c) {
+            case '"': *p++ = '"'; break;
+            case '\\': *p++ = '\\'; break;
+            case '\n': *p++ = 'n'; break;
+            case '\r': *p++ = 'r'; break;
+            case '\t': *p++ = 't'; break;
+            default:
+                p = copy_n("u00", 3, p);
+                *p++ = "0123456789abcdef"[c >> 4];
+                *p++ = "0123456789abcdef"[c & 15];
+        }
+        out.commit(p);
+    }
+    out.append(text.substr(start));
+    out.put('"');
+}
+
+// Name as a CSV field, quoted only when it holds a comma, quote or line break
+void appendCsvField(OutputBuffer& out, string_view text) {
+    if (text.find_first_of(",\"\r\n") == string_view::npos) {
+        out.append(text);
+        return;
+    }
+    out.put('"');
+    size_t start = 0;
+    for (size_t quote = text.find('"'); quote != string_view::npos; quote = text.find('"', start)) {
+        out.append(text.substr(start, quote + 1 - start));
+        out.put('"'); // double the quote
+        start = quote + 1;
+    }
+    out.append(text.substr(start));
+    out.put('"');
+}
+
+// The numeric fields, with the same two decimals as the text report
+char* appendRecordFields(char* p, const CityForecast& forecast, bool json) {
+    const auto field = [&p, json](const char* jsonKey) {
+        if (json) {
+            p = copy_n(",\"", 2, p);
+            p = copy(jsonKey, jsonKey + strlen(jsonKey), p);
+            p = copy_n("\":", 2, p);
+        } else {
+            *p++ = ',';
+        }
+    };
+    const auto symbol = [&p, json](char c) {
+        if (json) *p++ = '"';
+        *p++ = c;
+        if (json) *p++ = '"';
+    };
+    char* end = p + 256; // generous bound for everything below
+    field("id");
+    p = to_chars(p, end, forecast.id).ptr;
+    field("acc");
+    p = to_chars(p, end, forecast.acc, chars_format::fixed, 2).ptr;
+    field("ap");
+    p = to_chars(p, end, forecast.ap, chars_format::fixed, 2).ptr;
+    field("acc_symbol");
+    symbol(forecast.accSymbol);
+    field("ap_symbol");
+    symbol(forecast.apSymbol);
+    field("rain_probability");
+    p = to_chars(p, end, forecast.rainProbability).ptr;
+    field("city_cells");
+    p = to_chars(p, end, forecast.cityCells).ptr;
+    field("perimeter_cells");
+    p = to_chars(p, end, forecast.perimeterCells).ptr;
+    return p;
+}
+
+const char* const CsvForecastHeader = "name,id,acc,ap,acc_symbol,ap_symbol,rain_probability,city_cells,perimeter_cells\n";
+
+// One city in any report format; text goes through printForecast()
+void writeForecastRecord(OutputBuffer& out, ReportFormat format, const CityForecast& forecast) {
+    if (format == ReportFormat::Text) {
+        thread_local ostringstream text;
+        text.str(string());
+        printForecast(text, forecast);
+        out.append(text.str());
+        return;
+    }
+    
+    bool json = (format == ReportFormat::JsonLines);
+    if (json) {
+        out.append("{\"name\":");
+        appendJsonString(out, forecast.name);
+    } else {
+        out.csvRecord(CsvForecastHeader);
+        appendCsvField(out, forecast.name);
+    }
+    char* p = appendRecordFields(out.reserve(256), forecast, json);
+    if (json) *p++ = '}';
+    *p++ = '\n';
+    out.commit(p);
+}
+
+void writeForecastRecords(OutputBuffer& out, ReportFormat format, const vector<CityForecast>& forecasts) {
+    for (const CityForecast& forecast : forecasts) {
+        writeForecastRecord(out, format, forecast);
+    }
+}
+
+const char* const CsvRegionHeader = "x1,x2,y1,y2,cells,cloud_sum,cloud_mean,pressure_sum,pressure_mean\n";
+
+// One region query in any report format; text goes through printRegion().
+// An empty region has 0 cells, sums and means.
+void writeRegionRecord(OutputBuffer& out, ReportFormat format, const RegionStats& stats) {
+    if (format == ReportFormat::Text) {
+        ostringstream text;
+        printRegion(text, stats);
+        out.append(text.str());
+        return;
+    }
+    
+    bool json = (format == ReportFormat::JsonLines);
+    if (!json) out.csvRecord(CsvRegionHeader);
+    char* p = out.reserve(256);
+    char* end = p + 256; // generous bound for everything below
+    const char* keys[] = { "x1", "x2", "y1", "y2", "cells", "cloud_sum", "cloud_mean", "pressure_sum", "pressure_mean" };
+    const auto field = [&p, json, &keys](int i) {
+        if (json) {
+            p = copy_n(i == 0 ? "{\"" : ",\"", 2, p);
+            p = copy(keys[i], keys[i] + strlen(keys[i]), p);
+            p = copy_n("\":", 2, p);
+        } else if (i > 0) {
+            *p++ = ',';
+        }
+    };
+    const int corners[] = { stats.x1, stats.x2, stats.y1, stats.y2 };
+    for (int i = 0; i < 4; i++) {
+        field(i);
+        p = to_chars(p, end, corners[i]).ptr;
+    }
+    field(4);
+    p = to_chars(p, end, stats.cells).ptr;
+    for (int layer = 0; layer < 2; layer++) {
+        field(5 + 2 * layer);
+        p = to_chars(p, end, stats.sum[layer]).ptr;
+        field(6 + 2 * layer);
+        p = to_chars(p, end, stats.mean[layer], chars_format::fixed, 2).ptr;
+    }
+    if (json) *p++ = '}';
+    *p++ = '\n';
+    out.commit(p);
+}
+
+// ----------------
+// Streaming Report
+// ----------------
+// The report in one pass over the cloud and pressure files, without loading
+// either layer. Both files must list their cells in row order: y never goes
+// down, x can be in any order within a row. The two files are read in step
+// into one buffer row each. A city's footprint (its cells and perimeter) is
+// built when the sweep reaches the first row it can touch and dropped once
+// its last row has been added, so only the cities crossing the current row
+// hold cells. Cities are written in the report's name order as soon as they
+// and every city before them are finished. Besides the city list, memory is
+// two grid rows plus the footprints of the cities in progress.
+
+// Reads the values of grid columns xMin..xMax of one file a row at a time
+class ValueRowReader {
+public:
+    ValueRowReader(const string& kind, ParseStats& stats, int xMin, int xMax)
+        : kind(kind), stats(stats), xMin(xMin), xMax(xMax) {}
+
+    bool open(const string& fileName, ostream& log) {
+        stats.clear();
+        if (fileName.empty()) {
+            log << "Error: " << (char)toupper(kind[0]) << kind.substr(1) << " filename not found. Please read config file first!" << endl;
+            return false;
+        }
+        file.open(fileName);
+        if (!file) {
+            log << "Error: Cannot open " << fileName << endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Fill 'row' (one value per grid column) with grid row 'y', passing over
+    // any rows before it. False if the file turns out not to be in row order.
+    bool readRow(int y, uint8_t* row, ostream& log) {
+        fill(row, row + (xMax - xMin + 1), 0);
+        while (pending || next(log)) {
+            if (pendingY > y) return true;
+            if (pendingY == y && pendingX >= xMin && pendingX <= xMax) {
+                row[pendingX - xMin] = (uint8_t)pendingValue;
+            }
+            pending = false;
+        }
+        return !failed; // end of file is fine, a row order error is not
+    }
+
+    // Read what is left, so warnings and the row order check cover the whole file
+    bool finish(ostream& log) {
+        pending = false;
+        while (next(log)) pending = false;
+        return !failed;
+    }
+
+private:
+    // Move to the next value line; false at end of file or on a row order error
+    bool next(ostream& log) {
+        while (getline(file, line)) {
+            lineNumber++;
+            int x, y, value;
+            bool accepted = acceptValueLine(line, kind, stats, warnings, x, y, value);
+            if (!warnings.empty()) {
+                log << warnings << flush;
+                warnings.clear();
+            }
+            if (!accepted) continue;
+            
+            if (y < lastY) {
+                log << "Error: " << (char)toupper(kind[0]) << kind.substr(1) << " data is not sorted by row (line "
+                    << lineNumber << ")" << endl;
+                failed = true;
+                return false;
+            }
+            lastY = y;
+            pending = true;
+            pendingX = x;
+            pendingY = y;
+            pendingValue = value;
+            return true;
+        }
+        return false;
+    }
+
+    string kind;
+    ParseStats& stats;
+    int xMin, xMax;
+    ifstream file;
+    string line, warnings;
+    size_t lineNumber = 0;
+    int lastY = INT_MIN;
+    bool pending = false, failed = false;
+    int pendingX = 0, pendingY = 0, pendingValue = 0;
+};
+
+// A city the sweep has reached: its in-grid footprint cells in row order
+// and the next of them to add
+struct StreamingCity {
+    uint32_t group;
+    vector<pair<int, int>> cells;
+    size_t next = 0;
+};
+
+bool ForecastEngine::streamWeatherReport(OutputBuffer& out, ReportFormat format, ostream& log) {
+    LoadContext ctx(log);
+    if (!ensureCityData(ctx)) return false;
+    
+    ValueRowReader cloud("cloud", cloudParseStats, gridX_min, gridX_max);
+    ValueRowReader pressure("pressure", pressureParseStats, gridX_min, gridX_max);
+    if (!cloud.open(cloudFileName, log) || !pressure.open(pressureFileName, log)) return false;
+    
+    // First row each city's footprint can touch: its top row less the
+    // perimeter radius, clipped to the grid. INT_MIN when no row of the
+    // footprint can be in the grid, so those cities are finished first.
+    size_t count = cityIndex.size();
+    vector<int> firstRow(count);
+    for (uint32_t group = 0; group < count; group++) {
+        int top = INT_MAX, bottom = INT_MIN;
+        for (const auto& pos : cityIndex.cellsOf(group)) {
+            top = min(top, max(pos.second - perimeterRadius, gridY_min));
+            bottom = max(bottom, min(pos.second + perimeterRadius, gridY_max));
+        }
+        firstRow[group] = (top <= bottom) ? top : INT_MIN;
+    }
+    vector<uint32_t> startOrder(count);
+    for (uint32_t i = 0; i < count; i++) startOrder[i] = i;
+    stable_sort(startOrder.begin(), startOrder.end(), [&firstRow](uint32_t a, uint32_t b) {
+        return firstRow[a] < firstRow[b];
+    });
+    
+    if (format == ReportFormat::Text) {
+        out.append("\nWeather Forecast Summary Report\n");
+        out.append("===============================\n");
+    }
+    vector<CityForecast> forecasts(count);
+    vector<LayerSums<2>> sums(count);
+    vector<uint8_t> finished(count, 0);
+    size_t emitted = 0;
+    const auto finish = [&](uint32_t group) {
+        finishForecast(forecasts[group], sums[group]);
+        finished[group] = 1;
+        for (; emitted < count && finished[emitted]; emitted++) writeForecastRecord(out, format, forecasts[emitted]);
+    };
+    
+    vector<pair<int, int>> perimeterPositions;
+    vector<StreamingCity> active;
+    size_t started = 0;
+    for (; started < count && firstRow[startOrder[started]] == INT_MIN; started++) {
+        cityFootprint(startOrder[started], forecasts[startOrder[started]], perimeterPositions);
+        finish(startOrder[started]); // nothing of it is in the grid
+    }
+    
+    vector<uint8_t> cloudRow(grid_width), pressureRow(grid_width);
+    while (started < count || !active.empty()) {
+        // The next row any city needs, or where the next city can start
+        int y = active.empty() ? firstRow[startOrder[started]] : INT_MAX;
+        for (const StreamingCity& city : active) y = min(y, city.cells[city.next].second);
+        
+        // Bring in the cities whose footprint can start on this row
+        for (; started < count && firstRow[startOrder[started]] <= y; started++) {
+            uint32_t group = startOrder[started];
+            cityFootprint(group, forecasts[group], perimeterPositions);
+            StreamingCity city{ group, {} };
+            for (CellSpan positions : { cityIndex.cellsOf(group), CellSpan(perimeterPositions) }) {
+                for (const auto& pos : positions) {
+                    // same bounds check as accumulateLayers()
+                    if (pos.first < gridX_min || pos.first > gridX_max || pos.second < gridY_min || pos.second > gridY_max) continue;
+                    city.cells.push_back(pos);
+                }
+            }
+            if (city.cells.empty()) {
+                finish(group);
+                continue;
+            }
+            stable_sort(city.cells.begin(), city.cells.end(), [](const pair<int, int>& a, const pair<int, int>& b) {
+                return a.second < b.second;
+            });
+            active.push_back(std::move(city));
+        }
+        if (active.empty()) continue;
+        y = INT_MAX;
+        for (const StreamingCity& city : active) y = min(y, city.cells[city.next].second);
+        
+        if (!cloud.readRow(y, cloudRow.data(), log) || !pressure.readRow(y, pressureRow.data(), log)) return false;
+        for (size_t i = 0; i < active.size();) {
+            StreamingCity& city = active[i];
+            LayerSums<2>& citySums = sums[city.group];
+            for (; city.next < city.cells.size() && city.cells[city.next].second == y; city.next++) {
+                citySums.total[0] += cloudRow[city.cells[city.next].first - gridX_min];
+                citySums.total[1] += pressureRow[city.cells[city.next].first - gridX_min];
+                citySums.cells++;
+            }
+            if (city.next < city.cells.size()) {
+                i++;
+                continue;
+            }
+            finish(city.group);
+            active[i] = std::move(active.back());
+            active.pop_back();
+        }
+    }
+    return cloud.finish(log) && pressure.finish(log);
+}
+
+// -------------------
+// Incremental Updates
+// -------------------
+// Providers send small corrections as delta files: ordinary "[x, y]-value"
+// lines applied over a loaded layer. Instead of reloading and recomputing
+// every city, a ForecastIndex keeps each city's cloud and pressure totals and
+// a reverse index from grid cell to the cities whose city or perimeter cells
+// include it. A changed cell adds its change in value to just those cities'
+// totals, so an update costs time in proportion to the delta, not the grid.
+struct ForecastIndex {
+    vector<CityForecast> forecasts;            // city index order, as in the report
+    vector<LayerSums<2>> sums;                 // cloud and pressure totals of forecasts[i]
+    vector<pair<size_t, uint32_t>> cellCities; // (grid cell, city) for every footprint cell, by cell
+    size_t builtFrom[3] = { SIZE_MAX, SIZE_MAX, SIZE_MAX }; // city, cloud, pressure LayerCache::generation
+};
+
+// Forecast, totals and footprint cells of every city in the city index
+void ForecastEngine::buildForecastIndex(ForecastIndex& index) {
+    size_t count = cityIndex.size();
+    index.forecasts.assign(count, CityForecast());
+    index.sums.assign(count, LayerSums<2>());
+    
+    // A cell a city lists twice is counted twice, in the totals and here
+    vector<vector<size_t>> footprints(count);
+    const array<const ValueLayer*, 2> reportLayers = { &cloudData, &pressureData };
+    parallelFor(count, [&](size_t i) {
+        thread_local vector<pair<int, int>> perimeterPositions;
+        cityFootprint(i, index.forecasts[i], perimeterPositions);
+        accumulateLayers(reportLayers, cityIndex.cellsOf(i), index.sums[i]);
+        accumulateLayers(reportLayers, perimeterPositions, index.sums[i]);
+        finishForecast(index.forecasts[i], index.sums[i]);
+        
+        for (CellSpan positions : { cityIndex.cellsOf(i), CellSpan(perimeterPositions) }) {
+            for (const auto& pos : positions) {
+                if (!cloudData.containsWorld(pos.first, pos.second)) continue;
+                footprints[i].push_back((size_t)(pos.second - gridY_min) * grid_width + (pos.first - gridX_min));
+            }
+        }
+    });
+    
+    size_t total = 0;
+    for (const vector<size_t>& cells : footprints) total += cells.size();
+    index.cellCities.clear();
+    index.cellCities.reserve(total);
+    for (size_t i = 0; i < footprints.size(); i++) {
+        for (size_t cell : footprints[i]) {
+            index.cellCities.push_back({ cell, (uint32_t)i });
+        }
+    }
+    sort(index.cellCities.begin(), index.cellCities.end());
+}
+
+// Load all three layers and rebuild the index if any of them changed
+bool ForecastEngine::ensureForecastIndex(ForecastIndex& index, ostream& log) {
+    if (!ensureAllData(log)) return false;
+    
+    size_t current[3] = { cityCache.generation, cloudCache.generation, pressureCache.generation };
+    if (equal(current, current + 3, index.builtFrom)) return true;
+    
+    buildForecastIndex(index);
+    copy(current, current + 3, index.builtFrom);
+    return true;
+}
+
+// Apply the lines of 'in' to one layer (0 = cloud, 1 = pressure) and
+// recompute the cities whose totals changed; their indexes go to 'affected'
+// in name order. Bad lines are warned about and skipped, as in a full load.
+void ForecastEngine::applyDelta(ForecastIndex& index, istream& in, int layer, vector<size_t>& affected, ostream& log) {
+    ValueLayer::Writer values((layer == 0) ? cloudData : pressureData);
+    const string kind = (layer == 0) ? "cloud" : "pressure";
+    ParseStats stats;
+    string line, warnings;
+    bool changed = false;
+    affected.clear();
+    while (getline(in, line)) {
+        int x, y, value;
+        bool accepted = acceptValueLine(line, kind, stats, warnings, x, y, value);
+        if (!warnings.empty()) {
+            log << warnings;
+            warnings.clear();
+        }
+        if (!accepted || !values.containsWorld(x, y)) continue;
+        
+        int change = value - values.atWorld(x, y);
+        if (change == 0) continue;
+        values.setWorld(x, y, (uint8_t)value);
+        changed = true;
+        
+        size_t cell = (size_t)(y - gridY_min) * grid_width + (x - gridX_min);
+        auto first = lower_bound(index.cellCities.begin(), index.cellCities.end(), make_pair(cell, (uint32_t)0));
+        for (auto it = first; it != index.cellCities.end() && it->first == cell; ++it) {
+            index.sums[it->second].total[layer] += change;
+            affected.push_back(it->second);
+        }
+    }
+    log << flush;
+    
+    sort(affected.begin(), affected.end());
+    affected.erase(unique(affected.begin(), affected.end()), affected.end());
+    for (size_t i : affected) {
+        finishForecast(index.forecasts[i], index.sums[i]);
+    }
+    
+    // The layer now differs from its file; data derived from it is stale
+    // (but the index itself is up to date)
+    if (changed) {
+        LayerCache& cache = (layer == 0) ? cloudCache : pressureCache;
+        cache.generation++;
+        index.builtFrom[1 + layer] = cache.generation;
+    }
+}
+
+bool ForecastEngine::applyDeltaFile(ForecastIndex& index, const string& fileName, int layer, vector<size_t>& affected, ostream& log) {
+    if (!ensureForecastIndex(index, log)) return false;
+    
+    ifstream file(fileName);
+    if (!file) {
+        log << "Error: Cannot open " << fileName << endl;
+        return false;
+    }
+    applyDelta(index, file, layer, affected, log);
+    return true;
+}
+
+// The recomputed cities only, as text like the report or as records
+void writeForecastUpdate(OutputBuffer& records, ReportFormat format, const ForecastIndex& index, const vector<size_t>& affected) {
+    if (format != ReportFormat::Text) {
+        for (size_t i : affected) {
+            writeForecastRecord(records, format, index.forecasts[i]);
+        }
+        return;
+    }
+    
+    ostringstream text;
+    text << "\nWeather Forecast Update\n";
+    text << "=======================\n";
+    text << "Cities recomputed : " << affected.size() << '\n';
+    for (size_t i : affected) {
+        printForecast(text, index.forecasts[i]);
+    }
+    records.append(text.str());
+}
+
+
+// ------------------------
+// User Interface Functions
+// ------------------------
+// Menu entries run from 1 to LastChoice, new entries go in front of Quit
+const int QuitChoice = 10;
+const int LastChoice = QuitChoice;
+
+// DIsplays the main menu with all available options
+void showMenu() {
+    cout << "Student ID: 8551285" << endl;
+    cout << "Student Name: Jason Agnus Dei Liemanta" << endl;
+    cout << "---------------------------------------------" << endl;
+    cout << "Welcome to Weather Information Processing System!\n" << endl;
+    cout << "1) Read in and process a configuration file" << endl;
+    cout << "2) Display city map" << endl;
+    cout << "3) Display cloud coverage map (cloudiness index)" << endl;
+    cout << "4) Display cloud coverage map (LMH symbols)" << endl;
+    cout << "5) Display atmospheric pressure map (pressure index)" << endl;
+    cout << "6) Display atmospheric pressure map (LMH symbols)" << endl;
+    cout << "7) Show weather forecast summary report" << endl;
+    cout << "8) Show region averages" << endl;
+    cout << "9) Display rain probability map" << endl;
+    cout << "10) Quit" << endl;
+    cout << "Please enter your choice : ";
+}
+
+// -----------------------
+// Wait for enter function
+// -----------------------
+void waitForEnter() {
+    cout << "\nPress <enter> to go back to main menu...";
+    string dummy;                                        
+    getline(cin, dummy);                            
+}
+
+// -------------------------
+// Get Valid Choice Function
+// -------------------------
+int getValidChoice() {
+    int choice;
+    string input;
+    
+    // Loop until valid input
+    while (true) {
+        getline(cin, input);
+        input = trim(input);
+        
+        // Check if input is empty
+        if (input.empty()) {
+            cout << "Please enter a valid choice (1-" << LastChoice << "): ";
+            continue;
+        }
+        
+        // Check if input contains only digits
+        bool isValid = true;
+        for (char c : input) {
+            if (!isdigit(c)) {
+                isValid = false;
+                break;
+            }
+        }
+        
+        if (!isValid) {
+            cout << "Invalid input! Please enter a number (1-" << LastChoice << "): ";
+            continue;
+        }
+        
+        // Convert string to integer
         try {
-            // Parse format: [x, y]-value
-            size_t start = line.find('[');
-            size_t comma = line.find(',');
-            size_t end = line.find(']');
-            size_t dash = line.find('-', end);
+            choice = stoi(input);
+        } catch (const exception& e) {
+            cout << "Invalid input! Please enter a number (1-" << LastChoice << "): ";
+            continue;
+        }
+        
+        // Check if choice is in valid range
+        if (choice >= 1 && choice <= LastChoice) {
+            return choice;
+        } else {
+            cout << "Please enter a valid choice (1-" << LastChoice << "): ";
+        }
+    }
+}
+
+// -------------------
+// Benchmark Functions
+// -------------------
+// Run with: ./csci251_a1.app [--threads N] --bench perimeter|report|classify|records|region
+
+// The original perimeter search: linear scans of the city and perimeter lists
+// for every neighbour. Kept as the baseline and correctness check.
+void naivePerimeter(const Dataset& data, const vector<pair<int, int>>& cityPositions, vector<pair<int, int>>& perimeterPositions) {
+    const int dx[] = {-1, -1, -1, 0, 0, 1, 1, 1};
+    const int dy[] = {-1, 0, 1, -1, 1, -1, 0, 1};
+    perimeterPositions.clear();
+    for (const auto& pos : cityPositions) {
+        for (int i = 0; i < 8; i++) {
+            int nx = pos.first + dx[i];
+            int ny = pos.second + dy[i];
+            if (nx < data.gridX_min || nx > data.gridX_max || ny < data.gridY_min || ny > data.gridY_max) continue;
             
-            if (start == string::npos || comma == string::npos || 
-                end == string::npos || dash == string::npos) {
-                continue; // Skip malformed lines
+            bool seen = false;
+            for (const auto& cityPos : cityPositions) {
+                if (cityPos.first == nx && cityPos.second == ny) { seen = true; break; }
             }
-            
-            // Extract coordinates and values
-            int x = stoi(trim(line.substr(start + 1, comma - start - 1)));
-            int y = stoi(trim(line.substr(comma + 1, end - comma - 1)));
-            int value = stoi(trim(line.substr(dash + 1)));
-            
-            // Store in grid
-            int gridX = x - gridX_min;
-            int gridY = y - gridY_min;
-            if (gridX >= 0 && gridX < grid_width && gridY >= 0 && gridY < grid_height) {
-                pressureData[gridY][gridX] = value;
+            for (size_t k = 0; !seen && k < perimeterPositions.size(); k++) {
+                if (perimeterPositions[k].first == nx && perimeterPositions[k].second == ny) seen = true;
             }
-        } catch (const exception& e) {
-            cout << "Warning: Could not parse pressure data line: " << line << endl;
+            if (!seen) perimeterPositions.push_back({nx, ny});
         }
     }
-    file.close();
-    return true;
 }
 
-// -------------------------
-// Display City Map Function
-// -------------------------
-void displayCityMap() {
-    if (!configLoaded) {
-        cout << "Please read config file first!" << endl;
-        waitForEnter();
-        return;
+double elapsedMs(chrono::steady_clock::time_point since) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - since).count();
+}
+
+// Solid square cities of growing size on a 2000 x 2000 grid. The naive
+// search is only timed while it stays under a few seconds.
+int benchPerimeter() {
+    ForecastEngine engine;
+    engine.gridX_min = 0; engine.gridX_max = 1999;
+    engine.gridY_min = 0; engine.gridY_max = 1999;
+    engine.allocateGrids();
+    
+    cout << "city cells  perimeter  naive ms   bitmask ms  r=2 ms   r=3 ms" << endl;
+    for (int side : {32, 100, 200, 500, 1000}) {
+        vector<pair<int, int>> cityPositions, fast, slow;
+        for (int y = 0; y < side; y++) {
+            for (int x = 0; x < side; x++) {
+                cityPositions.push_back({500 + x, 500 + y});
+            }
+        }
+        
+        auto start = chrono::steady_clock::now();
+        engine.findPerimeter(cityPositions, fast);
+        double fastMs = elapsedMs(start);
+        
+        cout << setw(10) << cityPositions.size() << setw(11) << fast.size();
+        if (side <= 100) {
+            start = chrono::steady_clock::now();
+            naivePerimeter(engine, cityPositions, slow);
+            double slowMs = elapsedMs(start);
+            
+            sort(fast.begin(), fast.end());
+            sort(slow.begin(), slow.end());
+            if (fast != slow) {
+                cout << endl << "Error: perimeter mismatch" << endl;
+                return 1;
+            }
+            cout << setw(11) << fixed << setprecision(2) << slowMs;
+        } else {
+            cout << setw(11) << "-";
+        }
+        cout << setw(13) << fixed << setprecision(3) << fastMs;
+        
+        // Wider rings cost about the same
+        for (int radius : {2, 3}) {
+            engine.perimeterRadius = radius;
+            start = chrono::steady_clock::now();
+            engine.findPerimeter(cityPositions, fast);
+            cout << setw(9) << fixed << setprecision(3) << elapsedMs(start);
+        }
+        engine.perimeterRadius = 1;
+        cout << endl;
     }
     
-    // Load city data
-    if (!readCityData()) {
-        waitForEnter();
-        return;
+    // One name at opposite corners: the box is the whole grid, so the cells are sorted instead
+    vector<pair<int, int>> cityPositions = { {0, 0}, {1, 0}, {0, 1}, {1999, 1999}, {1998, 1999} }, fast, slow;
+    auto start = chrono::steady_clock::now();
+    engine.findPerimeter(cityPositions, fast);
+    double fastMs = elapsedMs(start);
+    naivePerimeter(engine, cityPositions, slow);
+    sort(fast.begin(), fast.end());
+    sort(slow.begin(), slow.end());
+    if (fast != slow) {
+        cout << "Error: scattered city perimeter mismatch" << endl;
+        return 1;
     }
+    cout << "scattered city: " << cityPositions.size() << " cells, " << fast.size() << " perimeter, "
+         << fixed << setprecision(3) << fastMs << " ms" << endl;
+    return 0;
+}
+
+// Synthetic national grid: 4000 x 4000 cells of random cloud/pressure with
+// 200k small cities plus a few metropolitan ones of 10k-40k cells, timed at
+// growing thread counts. Every run must produce the same forecasts.
+int benchReport() {
+    ForecastEngine engine;
+    engine.gridX_min = 0; engine.gridX_max = 3999;
+    engine.gridY_min = 0; engine.gridY_max = 3999;
+    engine.allocateGrids();
     
-    cout << "\nCity Map" << endl;
-    cout << "--------" << endl;
+    uint32_t seed = 12345;
+    auto nextRandom = [&seed]() {
+        seed = seed * 1664525u + 1013904223u;
+        return seed >> 8;
+    };
+    for (int y = 0; y < engine.grid_height; y++) {
+        for (int x = 0; x < engine.grid_width; x++) {
+            engine.cloudData.set(x, y, nextRandom() % 100);
+            engine.pressureData.set(x, y, nextRandom() % 100);
+        }
+    }
     
-    // Print top border
-    cout << "     ";                                      // Space for y-axis labels
-    for (int x = gridX_min - 1; x <= gridX_max; x++) {   
-        cout << "# ";                                     // Each '#' with space
+    for (int c = 0; c < 200000; c++) {
+        int side = (c % 1000 == 0) ? 100 + c / 1000 : 1 + nextRandom() % 5;
+        int x0 = nextRandom() % (engine.grid_width - side), y0 = nextRandom() % (engine.grid_height - side);
+        uint32_t name = engine.cityNames.intern("City" + to_string(c));
+        for (int dy = 0; dy < side; dy++) {
+            for (int dx = 0; dx < side; dx++) {
+                engine.cities.push_back({ x0 + dx, y0 + dy, c + 1, name });
+            }
+        }
     }
-    cout << "#" << endl;                                  // Final '#' for right border
+    engine.buildCityIndex();
     
-    // Print grid with Y-axis from top to bottom (gridY_max to gridY_min)
-    for (int y = gridY_max; y >= gridY_min; y--) {
-        // Print Y-axis label and left border
-        cout << setw(3) << y << "  # ";
+    unsigned hardware = max(thread::hardware_concurrency(), 1u);
+    cout << engine.cityIndex.size() << " cities, " << hardware << " hardware threads" << endl;
+    cout << "threads   ms        speedup" << endl;
+    
+    vector<CityForecast> reference, forecasts;
+    double baseMs = 0;
+    for (unsigned threads = 1; threads <= max(hardware, 4u); threads *= 2) {
+        workerThreads = threads;
+        workerPool(); // build the pool outside the timed region
         
-        // Print grid content with spaces
-        for (int x = gridX_min; x <= gridX_max; x++) {
-            int gridX = x - gridX_min;
-            int gridY = y - gridY_min;
-            if (cityGrid[gridY][gridX] != 0) {
-                cout << cityGrid[gridY][gridX] << " ";
-            } else {
-                cout << "  ";
+        double best = 1e30;
+        for (int run = 0; run < 3; run++) {
+            auto start = chrono::steady_clock::now();
+            engine.forecastCities(forecasts);
+            best = min(best, elapsedMs(start));
+        }
+        if (threads == 1) {
+            reference = forecasts;
+            baseMs = best;
+        }
+        for (size_t i = 0; i < forecasts.size(); i++) {
+            if (forecasts[i].acc != reference[i].acc || forecasts[i].ap != reference[i].ap) {
+                cout << "Error: results differ with " << threads << " threads" << endl;
+                return 1;
             }
         }
-        
-        // Print right border
-        cout << "#" << endl;
+        cout << setw(7) << threads << setw(10) << fixed << setprecision(1) << best
+             << setw(12) << setprecision(2) << baseMs / best << "x" << endl;
     }
+    return 0;
+}
+
+// Index and LMH classification of a 20000 x 4000 layer: scalar loop against
+// the kernel picked for this CPU, single-threaded so only the kernel differs
+int benchClassify() {
+    Grid<uint8_t> layer;
+    layer.reset(20000, 4000, 0, 0);
+    for (size_t i = 0; i < layer.size(); i++) layer.data()[i] = (uint8_t)((i * 37 + i / 7) % 100);
+    vector<char> scalar(layer.size()), vectored(layer.size());
+    const ClassifyKernels& kernels = classifyKernels();
     
-    // Print bottom border
-    cout << "     ";
-    for (int x = gridX_min - 1; x <= gridX_max; x++) {
-        cout << "# ";
+    cout << "kernel: " << kernels.name << endl;
+    cout << "class   scalar ms  " << setw(6) << kernels.name << " ms  speedup" << endl;
+    const pair<const char*, pair<ClassifyKernel, ClassifyKernel>> runs[] = {
+        { "index", { indexScalar, kernels.index } },
+        { "LMH", { lmhScalar, kernels.lmh } },
+    };
+    for (const auto& run : runs) {
+        double best[2] = { 1e30, 1e30 };
+        for (int rep = 0; rep < 5; rep++) {
+            auto start = chrono::steady_clock::now();
+            run.second.first(layer.data(), scalar.data(), layer.size());
+            best[0] = min(best[0], elapsedMs(start));
+            start = chrono::steady_clock::now();
+            run.second.second(layer.data(), vectored.data(), layer.size());
+            best[1] = min(best[1], elapsedMs(start));
+        }
+        if (scalar != vectored) {
+            cout << "Error: " << run.first << " kernel differs from scalar" << endl;
+            return 1;
+        }
+        cout << setw(5) << run.first << setw(12) << fixed << setprecision(2) << best[0]
+             << setw(12) << best[1] << setw(9) << best[0] / best[1] << "x" << endl;
     }
-    cout << "#" << endl;
     
-    // Print X-axis labels at the bottom
-    cout << "       ";
-    for (int x = gridX_min; x <= gridX_max; x++) {
-        cout << x << " ";
+    // Every byte value at every alignment and tail length, past the 0-99 a layer holds
+    uint8_t bytes[256 + 64];
+    for (size_t i = 0; i < sizeof(bytes); i++) bytes[i] = (uint8_t)(i * 7);
+    char want[256 + 64], got[256 + 64];
+    for (const auto& run : runs) {
+        for (size_t start = 0; start < 64; start++) {
+            for (size_t n = 0; start + n <= sizeof(bytes); n += (n < 80) ? 1 : 61) {
+                run.second.first(bytes + start, want, n);
+                run.second.second(bytes + start, got, n);
+                if (memcmp(want, got, n) != 0) {
+                    cout << "Error: " << run.first << " kernel differs from scalar at offset " << start << ", " << n << " cells" << endl;
+                    return 1;
+                }
+            }
+        }
     }
-    cout << endl;
-    
-    waitForEnter();
+    cout << "all byte values, offsets and tail lengths match scalar" << endl;
+    return 0;
 }
 
-// ----------------------------
-// Display Cloud Coverage Index
-// ----------------------------
-// Shows cloud coverage as index values
-void displayCloudCoverageIndex() {
-    if (!configLoaded) {
-        cout << "Please read config file first!" << endl;
-        waitForEnter();
-        return;
+// Serialize a million made-up forecasts to /dev/null in each report format
+int benchRecords() {
+    const size_t count = 1000000;
+    vector<string> names(count);
+    vector<CityForecast> forecasts(count);
+    for (size_t i = 0; i < count; i++) {
+        names[i] = "City" + to_string(i);
+        CityForecast& forecast = forecasts[i];
+        forecast.name = names[i];
+        forecast.id = (int)i + 1;
+        forecast.acc = (double)(i * 7919 % 9901) / 99;
+        forecast.ap = (double)(i * 104729 % 9973) / 101;
+        forecast.accSymbol = (forecast.acc < 35) ? 'L' : (forecast.acc < 65) ? 'M' : 'H';
+        forecast.apSymbol = (forecast.ap < 35) ? 'L' : (forecast.ap < 65) ? 'M' : 'H';
+        forecast.rainProbability = rainProbabilityFor(forecast.accSymbol, forecast.apSymbol);
+        forecast.cityCells = 1 + i % 25;
+        forecast.perimeterCells = 8 + i % 40;
     }
     
-    // Load cloud data
-    if (!readCloudData()) {
-        waitForEnter();
-        return;
+    // to_chars must round exactly like the text report's setprecision(2)
+    char buffer[32];
+    for (const CityForecast& forecast : forecasts) {
+        ostringstream expected;
+        expected << fixed << setprecision(2) << forecast.acc;
+        char* end = to_chars(buffer, buffer + sizeof(buffer), forecast.acc, chars_format::fixed, 2).ptr;
+        if (expected.str() != string_view(buffer, end - buffer)) {
+            cout << "Error: " << forecast.acc << " formats differently" << endl;
+            return 1;
+        }
     }
     
-    cout << "\nCloud Coverage Map (Cloudiness Index)" << endl;
-    cout << "-------------------------------------" << endl;
-    
-    // Print top border
-    cout << "     ";
-    for (int x = gridX_min - 1; x <= gridX_max; x++) {
-        cout << "# ";
+    int devNull = open("/dev/null", O_WRONLY);
+    if (devNull < 0) {
+        cout << "Error: Cannot open /dev/null" << endl;
+        return 1;
     }
-    cout << "#" << endl;
-    
-    // Print grid with cloudiness index
-    for (int y = gridY_max; y >= gridY_min; y--) {
-        cout << setw(3) << y << "  # ";
-        for (int x = gridX_min; x <= gridX_max; x++) {
-            int gridX = x - gridX_min;
-            int gridY = y - gridY_min;
-            int value = cloudData[gridY][gridX];
-            
-            // Convert to cloudiness index (0-9)
-            int index = value / 10;
-            if (index > 9) index = 9;
-            
-            cout << index << " ";
+    cout << count << " cities" << endl;
+    cout << "format   ms" << endl;
+    for (ReportFormat format : { ReportFormat::Text, ReportFormat::JsonLines, ReportFormat::Csv }) {
+        double best = 1e30;
+        for (int run = 0; run < 3; run++) {
+            auto start = chrono::steady_clock::now();
+            if (format == ReportFormat::Text) {
+                ostringstream text;
+                for (const CityForecast& forecast : forecasts) printForecast(text, forecast);
+                string out = text.str();
+                writeAll(devNull, out.data(), out.size());
+            } else {
+                OutputBuffer out(devNull);
+                writeForecastRecords(out, format, forecasts);
+                out.flush();
+            }
+            best = min(best, elapsedMs(start));
         }
-        cout << "#" << endl;
+        const char* label = (format == ReportFormat::Text) ? "text" : (format == ReportFormat::Csv) ? "csv" : "jsonl";
+        cout << setw(6) << label << setw(10) << fixed << setprecision(1) << best << endl;
     }
+    close(devNull);
+    return 0;
+}
+
+// Random rectangles: summed-area tables against scanning every cell
+int benchRegion() {
+    ForecastEngine engine;
+    engine.gridX_min = 0; engine.gridX_max = 3999;
+    engine.gridY_min = 0; engine.gridY_max = 3999;
+    engine.allocateGrids();
     
-    // Print bottom border
-    cout << "     ";
-    for (int x = gridX_min - 1; x <= gridX_max; x++) {
-        cout << "# ";
+    uint32_t seed = 12345;
+    auto nextRandom = [&seed]() {
+        seed = seed * 1664525u + 1013904223u;
+        return seed >> 8;
+    };
+    for (int y = 0; y < engine.grid_height; y++) {
+        for (int x = 0; x < engine.grid_width; x++) {
+            engine.cloudData.set(x, y, nextRandom() % 100);
+            engine.pressureData.set(x, y, nextRandom() % 100);
+        }
     }
-    cout << "#" << endl;
     
-    // Print X-axis labels at the bottom
-    cout << "       ";
-    for (int x = gridX_min; x <= gridX_max; x++) {
-        cout << x << " ";
-    }
-    cout << endl;
+    auto start = chrono::steady_clock::now();
+    engine.cloudSums.build(engine.cloudData);
+    engine.pressureSums.build(engine.pressureData);
+    double buildMs = elapsedMs(start);
     
-    waitForEnter();
-}
-
-// -----------------------------------
-// Display Cloud Coverage LMH Function
-// -----------------------------------
-// Shows cloud coverage as Low/Medium/High symbols
-void displayCloudCoverageLMH() {
-    if (!configLoaded) {
-        cout << "Please read config file first!" << endl;
-        waitForEnter();
-        return;
+    // Rectangles up to 500 cells a side, some reaching past the grid edge
+    const size_t queries = 20000;
+    vector<array<int, 4>> regions(queries);
+    for (auto& region : regions) {
+        int x = (int)(nextRandom() % (engine.grid_width + 100)) - 50, y = (int)(nextRandom() % (engine.grid_height + 100)) - 50;
+        region = { x, x + (int)(nextRandom() % 500), y, y + (int)(nextRandom() % 500) };
     }
     
-    // Load cloud data
-    if (!readCloudData()) {
-        waitForEnter();
-        return;
+    vector<RegionStats> fast(queries), naive(queries);
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < queries; i++) {
+        fast[i] = engine.queryRegion(regions[i][0], regions[i][1], regions[i][2], regions[i][3]);
     }
+    double fastMs = elapsedMs(start);
     
-    cout << "\nCloud Coverage Map (LMH symbols)" << endl;
-    cout << "---------------------------------" << endl;
-    
-    // Print top border
-    cout << "     ";
-    for (int x = gridX_min - 1; x <= gridX_max; x++) {
-        cout << "# ";
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < queries; i++) {
+        RegionStats& stats = naive[i];
+        for (int y = max(regions[i][2], engine.gridY_min); y <= min(regions[i][3], engine.gridY_max); y++) {
+            for (int x = max(regions[i][0], engine.gridX_min); x <= min(regions[i][1], engine.gridX_max); x++) {
+                stats.sum[0] += engine.cloudData.atWorld(x, y);
+                stats.sum[1] += engine.pressureData.atWorld(x, y);
+                stats.cells++;
+            }
+        }
     }
-    cout << "#" << endl;
+    double naiveMs = elapsedMs(start);
     
-    // Print grid with LMH symbols
-    for (int y = gridY_max; y >= gridY_min; y--) {
-        cout << setw(3) << y << "  # ";
-        for (int x = gridX_min; x <= gridX_max; x++) {
-            int gridX = x - gridX_min;
-            int gridY = y - gridY_min;
-            int value = cloudData[gridY][gridX];
-            
-            // Convert to LMH symbols according to Appendix C
-            char symbol;
-            if (value >= 0 && value < 35) {
-                symbol = 'L';
-            } else if (value >= 35 && value < 65) {
-                symbol = 'M';
-            } else {
-                symbol = 'H';
-            }
-            
-            cout << symbol << " ";
+    for (size_t i = 0; i < queries; i++) {
+        if (fast[i].cells != naive[i].cells || fast[i].sum[0] != naive[i].sum[0] || fast[i].sum[1] != naive[i].sum[1]) {
+            cout << "Error: region " << i << " differs from the naive scan" << endl;
+            return 1;
         }
-        cout << "#" << endl;
     }
+    cout << engine.grid_width << "x" << engine.grid_height << " grid, " << queries << " regions, tables built in "
+         << fixed << setprecision(1) << buildMs << " ms" << endl;
+    cout << "naive scan " << naiveMs << " ms, summed-area " << setprecision(2) << fastMs << " ms ("
+         << setprecision(0) << naiveMs / max(fastMs, 1e-3) << "x)" << endl;
+    return 0;
+}
+
+// Rain field from the box filter against the per-cell 3x3 scan it replaces
+int benchRain() {
+    ForecastEngine engine;
+    engine.gridX_min = 0; engine.gridX_max = 4000;
+    engine.gridY_min = 0; engine.gridY_max = 2998;
+    engine.allocateGrids();
     
-    // Print bottom border
-    cout << "     ";
-    for (int x = gridX_min - 1; x <= gridX_max; x++) {
-        cout << "# ";
+    uint32_t seed = 12345;
+    auto nextRandom = [&seed]() {
+        seed = seed * 1664525u + 1013904223u;
+        return seed >> 8;
+    };
+    for (int y = 0; y < engine.grid_height; y++) {
+        for (int x = 0; x < engine.grid_width; x++) {
+            engine.cloudData.set(x, y, nextRandom() % 100);
+            engine.pressureData.set(x, y, nextRandom() % 100);
+        }
     }
-    cout << "#" << endl;
     
-    // Print X-axis labels at the bottom
-    cout << "       ";
-    for (int x = gridX_min; x <= gridX_max; x++) {
-        cout << x << " ";
+    auto start = chrono::steady_clock::now();
+    engine.buildRainField(engine.cloudData, engine.pressureData);
+    double fastMs = elapsedMs(start);
+    
+    start = chrono::steady_clock::now();
+    Grid<uint8_t> naive;
+    naive.reset(engine.grid_width, engine.grid_height, engine.gridX_min, engine.gridY_min);
+    for (int y = 0; y < engine.grid_height; y++) {
+        for (int x = 0; x < engine.grid_width; x++) {
+            LayerSums<2> sums;
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    if (!engine.cloudData.inBounds(x + dx, y + dy)) continue;
+                    sums.total[0] += engine.cloudData.at(x + dx, y + dy);
+                    sums.total[1] += engine.pressureData.at(x + dx, y + dy);
+                    sums.cells++;
+                }
+            }
+            CityForecast forecast;
+            finishForecast(forecast, sums);
+            naive.at(x, y) = (uint8_t)forecast.rainProbability;
+        }
     }
-    cout << endl;
+    double naiveMs = elapsedMs(start);
     
-    waitForEnter();
+    for (int y = 0; y < engine.grid_height; y++) {
+        if (memcmp(naive.row(y), engine.rainField.row(y), engine.grid_width) != 0) {
+            cout << "Error: row " << y << " differs from the per-cell scan" << endl;
+            return 1;
+        }
+    }
+    cout << engine.grid_width << "x" << engine.grid_height << " grid, per-cell scan " << fixed << setprecision(1) << naiveMs
+         << " ms, box filter " << fastMs << " ms (" << setprecision(0) << naiveMs / max(fastMs, 1e-3) << "x)" << endl;
+    return 0;
 }
 
-// -------------------------------
-// Display Pressure Index Function
-// -------------------------------
-// Shows atmospheric pressure as index values (0-9)
-void displayPressureIndex() {
-    if (!configLoaded) {
-        cout << "Please read config file first!" << endl;
-        waitForEnter();
-        return;
+// A 5000-cell delta through the reverse index against recomputing every city
+int benchDelta() {
+    ForecastEngine engine;
+    engine.gridX_min = 0; engine.gridX_max = 3999;
+    engine.gridY_min = 0; engine.gridY_max = 3999;
+    engine.allocateGrids();
+    
+    uint32_t seed = 12345;
+    auto nextRandom = [&seed]() {
+        seed = seed * 1664525u + 1013904223u;
+        return seed >> 8;
+    };
+    for (int y = 0; y < engine.grid_height; y++) {
+        for (int x = 0; x < engine.grid_width; x++) {
+            engine.cloudData.set(x, y, nextRandom() % 100);
+            engine.pressureData.set(x, y, nextRandom() % 100);
+        }
     }
     
-    // Load pressure data
-    if (!readPressureData()) {
-        waitForEnter();
-        return;
+    for (int c = 0; c < 200000; c++) {
+        int side = 1 + nextRandom() % 5;
+        int x0 = nextRandom() % (engine.grid_width - side), y0 = nextRandom() % (engine.grid_height - side);
+        uint32_t name = engine.cityNames.intern("City" + to_string(c));
+        for (int dy = 0; dy < side; dy++) {
+            for (int dx = 0; dx < side; dx++) {
+                engine.cities.push_back({ x0 + dx, y0 + dy, c + 1, name });
+            }
+        }
     }
+    engine.buildCityIndex();
     
-    cout << "\nAtmospheric Pressure Map (Pressure Index)" << endl;
-    cout << "------------------------------------------" << endl;
+    ForecastIndex index;
+    auto start = chrono::steady_clock::now();
+    engine.buildForecastIndex(index);
+    double buildMs = elapsedMs(start);
     
-    // Print top border
-    cout << "     ";
-    for (int x = gridX_min - 1; x <= gridX_max; x++) {
-        cout << "# ";
+    string delta;
+    for (int i = 0; i < 5000; i++) {
+        delta += "[" + to_string(nextRandom() % engine.grid_width) + ", " + to_string(nextRandom() % engine.grid_height) + "]-" + to_string(nextRandom() % 100) + "\n";
     }
-    cout << "#" << endl;
+    istringstream in(delta);
+    vector<size_t> affected;
+    start = chrono::steady_clock::now();
+    engine.applyDelta(index, in, 0, affected, cout);
+    double deltaMs = elapsedMs(start);
     
-    // Print grid with pressure index
-    for (int y = gridY_max; y >= gridY_min; y--) {
-        cout << setw(3) << y << "  # ";
-        for (int x = gridX_min; x <= gridX_max; x++) {
-            int gridX = x - gridX_min;
-            int gridY = y - gridY_min;
-            int value = pressureData[gridY][gridX];
-            
-            // Convert to pressure index (0-9)
-            int index = value / 10;
-            if (index > 9) index = 9;
-            
-            cout << index << " ";
+    vector<CityForecast> forecasts;
+    start = chrono::steady_clock::now();
+    engine.forecastCities(forecasts);
+    double fullMs = elapsedMs(start);
+    
+    for (size_t i = 0; i < forecasts.size(); i++) {
+        if (forecasts[i].acc != index.forecasts[i].acc || forecasts[i].ap != index.forecasts[i].ap) {
+            cout << "Error: city " << i << " differs from a full recompute" << endl;
+            return 1;
         }
-        cout << "#" << endl;
     }
-    
-    // Print bottom border
-    cout << "     ";
-    for (int x = gridX_min - 1; x <= gridX_max; x++) {
-        cout << "# ";
+    cout << forecasts.size() << " cities, index built in " << fixed << setprecision(1) << buildMs << " ms ("
+         << index.cellCities.size() << " cell entries)" << endl;
+    cout << "5000-cell delta: " << affected.size() << " cities in " << setprecision(2) << deltaMs
+         << " ms, full recompute " << setprecision(1) << fullMs << " ms" << endl;
+    return 0;
+}
+
+int runBenchmark(const string& name) {
+    if (name == "perimeter") return benchPerimeter();
+    if (name == "report") return benchReport();
+    if (name == "classify") return benchClassify();
+    if (name == "records") return benchRecords();
+    if (name == "region") return benchRegion();
+    if (name == "rain") return benchRain();
+    if (name == "delta") return benchDelta();
+    cout << "Unknown benchmark: " << name << " (available: perimeter, report, classify, records, region, rain, delta)" << endl;
+    return 1;
+}
+
+// ----------
+// Batch Mode
+// ----------
+// Run with: ./csci251_a1.app --config FILE [--config FILE ...] [--format text|jsonl|csv] [--report] [--map NAME ...]
+// Every config is loaded in turn and the requested outputs are written to
+// stdout, in command-line order; messages go to stderr. With no --report or
+// --map the layers are only loaded, which checks the data files. --format
+// picks how --report and --region are written. In CSV a header row comes
+// just before the first record, and again whenever the records switch
+// between cities and regions, so a run with no records has none.
+//
+// --region X1,X2,Y1,Y2 writes the cloud and pressure sums and means over a
+// rectangle (see Region Queries) in --format, as one record per region, and --export-rain FILE saves the rain
+// probability field (see Rain Probability Field).
+//
+// --cloud-delta FILE and --pressure-delta FILE apply a delta file to the
+// loaded layer and write only the cities it changed, in --format (see
+// Incremental Updates). Later steps see the updated layer.
+//
+// --stream computes --report in one pass over row-sorted data files without
+// loading the layers (see Streaming Report); it can't be mixed with other steps.
+//
+// --snapshot FILE can be used wherever --config is (a snapshot given to
+// --config is recognised too), and --write-snapshot FILE saves the loaded
+// data of a single input. --verify also checks the snapshot grids' checksums.
+//
+// --watch runs the steps for a single --config again whenever its data files
+// change (see Watch Mode).
+//
+// --serve SOCKET keeps a single input loaded and answers requests on a Unix
+// socket; --query SOCKET REQUEST asks it one (see Query Server).
+
+// Exit status: the worst problem seen over all configs
+enum ExitStatus {
+    ExitOk = 0,
+    ExitUsage = 1,  // bad command line
+    ExitConfig = 2, // a config file could not be read
+    ExitData = 3    // a data file was missing or could not be read
+};
+
+enum class BatchAction { Report, Map, WriteSnapshot, Region, ExportRain, CloudDelta, PressureDelta };
+
+struct BatchStep {
+    BatchAction action;
+    const MapView* view;       // for BatchAction::Map
+    string path;               // output file, or the delta file to apply
+    array<int, 4> region = {}; // x1, x2, y1, y2 for BatchAction::Region
+};
+
+// A config file or a snapshot to run the steps on
+struct BatchInput {
+    string path;
+    bool snapshot;
+};
+
+bool loadBatchInput(ForecastEngine& engine, const BatchInput& input, bool verifySnapshots, ostream& log) {
+    if (input.snapshot || isSnapshotFile(input.path)) {
+        return engine.loadSnapshot(input.path, verifySnapshots, log);
     }
-    cout << "#" << endl;
-    
-    // Print X-axis labels at the bottom
-    cout << "       ";
-    for (int x = gridX_min; x <= gridX_max; x++) {
-        cout << x << " ";
+    return engine.loadConfigFile(input.path, false, log);
+}
+
+// Output buffers are kept across configs and refreshes so later runs reuse
+// the memory
+struct BatchOutputs {
+    string text;
+    Grid<char> symbols;
+    vector<CityForecast> forecasts;
+    OutputBuffer records{ STDOUT_FILENO };
+    ForecastIndex index;
+    vector<size_t> affected;
+};
+
+// Run every step on the loaded data, stopping at the first one that fails
+bool runBatchSteps(ForecastEngine& engine, const vector<BatchStep>& steps, ReportFormat format, bool stream, BatchOutputs& out) {
+    for (const BatchStep& step : steps) {
+        bool ok;
+        if (step.action == BatchAction::Map) {
+            ok = engine.buildMapView(*step.view, out.text, out.symbols, cerr);
+            if (ok) writeOutput(out.text);
+        } else if (step.action == BatchAction::WriteSnapshot) {
+            ok = engine.ensureAllData(cerr) && engine.writeSnapshot(step.path, cerr);
+        } else if (step.action == BatchAction::CloudDelta || step.action == BatchAction::PressureDelta) {
+            int layer = (step.action == BatchAction::CloudDelta) ? 0 : 1;
+            ok = engine.applyDeltaFile(out.index, step.path, layer, out.affected, cerr);
+            if (ok) writeForecastUpdate(out.records, format, out.index, out.affected);
+        } else if (step.action == BatchAction::ExportRain) {
+            LoadContext ctx(cerr);
+            ok = engine.ensureRainField(ctx) && engine.writeRainField(step.path, cerr);
+        } else if (step.action == BatchAction::Region) {
+            LoadContext ctx(cerr);
+            ok = engine.ensureRegionTables(ctx);
+            if (ok) {
+                RegionStats stats = engine.queryRegion(step.region[0], step.region[1], step.region[2], step.region[3]);
+                writeRegionRecord(out.records, format, stats);
+            }
+        } else if (stream) {
+            ok = engine.streamWeatherReport(out.records, format, cerr);
+        } else if (format == ReportFormat::Text) {
+            ok = engine.buildWeatherReport(out.text, out.forecasts, cerr);
+            if (ok) writeOutput(out.text);
+        } else {
+            ok = engine.computeWeatherReport(out.forecasts, cerr);
+            if (ok) writeForecastRecords(out.records, format, out.forecasts);
+        }
+        out.records.flush(); // keep records in order with the other outputs
+        if (!ok) return false; // later steps would fail on the same files
     }
-    cout << endl;
+    return true;
+}
+
+int runBatch(const vector<BatchInput>& inputs, const vector<BatchStep>& steps, ReportFormat format, bool verifySnapshots, bool stream) {
+    int status = ExitOk;
+    ForecastEngine engine;
+    BatchOutputs out;
     
-    waitForEnter();
+    for (const BatchInput& input : inputs) try {
+        if (!loadBatchInput(engine, input, verifySnapshots, cerr)) {
+            status = max(status, (int)ExitConfig);
+            continue;
+        }
+        
+        if (steps.empty()) {
+            if (!engine.ensureAllData(cerr)) status = max(status, (int)ExitData);
+            engine.printParseStats(cerr);
+            engine.printLayerCacheStats(cerr);
+            engine.printTileCacheStats(cerr);
+            continue;
+        }
+        
+        if (!runBatchSteps(engine, steps, format, stream, out)) status = max(status, (int)ExitData);
+        engine.printParseStats(cerr);
+        engine.printLayerCacheStats(cerr);
+        engine.printTileCacheStats(cerr);
+    } catch (const exception& e) {
+        // out-of-core layers report tile file failures this way
+        out.records.flush();
+        cerr << "Error: " << e.what() << endl;
+        status = max(status, (int)ExitData);
+    }
+    if (!out.records.flush()) {
+        cerr << "Error: Could not write report records" << endl;
+        status = max(status, (int)ExitData);
+    }
+    return status;
 }
 
-// -----------------------------
-// Display Pressure LMH Function
-// -----------------------------
-// Shows atmospheric pressure as Low/Medium/High symbols
-void displayPressureLMH() {
-    if (!configLoaded) {
-        cout << "Please read config file first!" << endl;
-        waitForEnter();
-        return;
+void printUsage(const char* program) {
+    cerr << "Usage: " << program << " [--threads N] [--memory-budget MB] [--bench perimeter|report|classify|records|region|rain|delta]" << endl;
+    cerr << "       " << program << " [--threads N] [--memory-budget MB] (--config FILE | --snapshot FILE) ... [--verify]" << endl;
+    cerr << "           [--format text|jsonl|csv] [--report] [--map NAME ...] [--region X1,X2,Y1,Y2 ...]" << endl;
+    cerr << "           [--cloud-delta FILE ...] [--pressure-delta FILE ...] [--export-rain FILE] [--write-snapshot FILE]" << endl;
+    cerr << "       " << program << " [--threads N] --config FILE ... [--format text|jsonl|csv] --stream --report" << endl;
+    cerr << "       " << program << " [--threads N] [--memory-budget MB] --config FILE --watch [--format text|jsonl|csv] [--report] [--map NAME ...] ..." << endl;
+    cerr << "       " << program << " [--threads N] [--memory-budget MB] (--config FILE | --snapshot FILE) --serve SOCKET" << endl;
+    cerr << "       " << program << " --query SOCKET REQUEST" << endl;
+    cerr << "--memory-budget limits the cloud and pressure layers only; maps, --region tables" << endl;
+    cerr << "and the rain field are still built at full grid size." << endl;
+    cerr << "Data file names in a config file are relative to the config file's directory." << endl;
+    cerr << "Maps:";
+    for (const MapView& view : mapViews) {
+        cerr << " " << view.name;
+    }
+    cerr << endl;
+}
+
+// ----------
+// Watch Mode
+// ----------
+// --watch keeps a batch run going for a dashboard: after the first run it
+// waits for the config's data files to change, lets a burst of writes settle
+// for WatchSettleMs, then runs the steps again. inotify watches the files'
+// directories rather than the files, so tools that replace a file by
+// renaming over it are seen too. Only the layers whose files changed are
+// re-read; the others stay in the layer cache.
+//
+// If the kernel's event queue overflows, events were lost, so every layer is
+// re-read. If a watched directory is removed or moved away, its layers are
+// re-read and the path is watched again after the settle time; if it can't
+// be, that is reported, and the watch ends once no layer is left.
+const int WatchSettleMs = 200;
+const uint32_t WatchEvents = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVE_SELF;
+
+struct WatchedLayer {
+    const char* kind;
+    const string* fileName;
+    LayerCache* cache;
+    int wd = -1;      // watch descriptor of the file's directory
+    string dir = {};  // that directory
+    string name = {}; // file name within that directory
+    bool changed = false;
+    bool rewatch = false; // the directory went away, watch its path again
+};
+
+// Watch the directories that went away again, by path, once the writes have
+// settled so a directory replaced by renaming is back in place
+void rewatchDirectories(int fd, vector<WatchedLayer>& layers) {
+    for (WatchedLayer& layer : layers) {
+        if (!layer.rewatch) continue;
+        layer.wd = inotify_add_watch(fd, layer.dir.c_str(), WatchEvents);
+        if (layer.wd < 0) {
+            cerr << "Error: Stopped watching " << layer.kind << " data in " << layer.dir << " (" << strerror(errno) << ")" << endl;
+        }
+        layer.rewatch = false;
+    }
+}
+
+// Read the pending events and mark the layers they name
+void readWatchEvents(int fd, vector<WatchedLayer>& layers) {
+    alignas(inotify_event) char buffer[4096];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (char* p = buffer; p < buffer + n; p += sizeof(inotify_event) + ((inotify_event*)p)->len) {
+            const inotify_event* event = (const inotify_event*)p;
+            if (event->mask & IN_Q_OVERFLOW) {
+                cerr << "Warning: Missed file changes, reloading every layer" << endl;
+                for (WatchedLayer& layer : layers) layer.changed = true;
+                continue;
+            }
+            if (event->mask & (IN_IGNORED | IN_MOVE_SELF)) {
+                // A moved directory keeps its watch, drop it; the files may have gone with it
+                if (event->mask & IN_MOVE_SELF) inotify_rm_watch(fd, event->wd);
+                for (WatchedLayer& layer : layers) {
+                    if (layer.wd != event->wd) continue;
+                    layer.wd = -1;
+                    layer.rewatch = layer.changed = true;
+                }
+                continue;
+            }
+            if (event->len == 0) continue;
+            for (WatchedLayer& layer : layers) {
+                if (layer.wd == event->wd && layer.name == event->name) layer.changed = true;
+            }
+        }
     }
+}
+
+int runWatch(const BatchInput& input, const vector<BatchStep>& steps, ReportFormat format) {
+    ForecastEngine engine;
+    if (!loadBatchInput(engine, input, false, cerr)) return ExitConfig;
     
-    // Load pressure data
-    if (!readPressureData()) {
-        waitForEnter();
-        return;
+    vector<WatchedLayer> layers = {
+        { "city", &engine.cityFileName, &engine.cityCache },
+        { "cloud", &engine.cloudFileName, &engine.cloudCache },
+        { "pressure", &engine.pressureFileName, &engine.pressureCache },
+    };
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        cerr << "Error: Cannot start watching files (" << strerror(errno) << ")" << endl;
+        return ExitData;
     }
-    
-    cout << "\nAtmospheric Pressure Map (LMH symbols)" << endl;
-    cout << "--------------------------------------" << endl;
-    
-    // Print top border
-    cout << "     ";
-    for (int x = gridX_min - 1; x <= gridX_max; x++) {
-        cout << "# ";
+    bool watching = false;
+    for (WatchedLayer& layer : layers) {
+        const string& path = *layer.fileName;
+        if (path.empty()) continue;
+        size_t slash = path.rfind('/');
+        layer.dir = (slash == string::npos) ? "." : path.substr(0, max(slash, (size_t)1));
+        layer.name = (slash == string::npos) ? path : path.substr(slash + 1);
+        layer.wd = inotify_add_watch(fd, layer.dir.c_str(), WatchEvents);
+        if (layer.wd < 0) {
+            cerr << "Error: Cannot watch " << layer.dir << " (" << strerror(errno) << ")" << endl;
+        } else {
+            watching = true;
+        }
+    }
+    if (!watching) {
+        ::close(fd);
+        cerr << "Error: No data files to watch" << endl;
+        return ExitData;
     }
-    cout << "#" << endl;
     
-    // Print grid with LMH symbols
-    for (int y = gridY_max; y >= gridY_min; y--) {
-        cout << setw(3) << y << "  # ";
-        for (int x = gridX_min; x <= gridX_max; x++) {
-            int gridX = x - gridX_min;
-            int gridY = y - gridY_min;
-            int value = pressureData[gridY][gridX];
-            
-            // Convert to LMH symbols according to Appendix D
-            char symbol;
-            if (value >= 0 && value < 35) {
-                symbol = 'L';
-            } else if (value >= 35 && value < 65) {
-                symbol = 'M';
-            } else {
-                symbol = 'H';
+    BatchOutputs out;
+    bool terminal = isatty(STDOUT_FILENO);
+    while (true) {
+        try {
+            if (terminal) writeOutput("\033[H\033[2J"); // redraw from the top
+            out.records.newCsvTable(); // each refresh is a complete CSV file
+            runBatchSteps(engine, steps, format, false, out);
+            out.records.flush();
+        } catch (const exception& e) {
+            // out-of-core layers report tile file failures this way
+            out.records.flush();
+            cerr << "Error: " << e.what() << endl;
+        }
+        cerr << "Watching for changes (Ctrl-C to stop)..." << endl;
+        
+        // Wait for a change to a watched file, then until the writes stop
+        bool changed = false;
+        while (!changed) {
+            if (none_of(layers.begin(), layers.end(), [](const WatchedLayer& layer) { return layer.wd >= 0; })) {
+                ::close(fd);
+                cerr << "Error: No data files left to watch" << endl;
+                return ExitData;
             }
-            
-            cout << symbol << " ";
+            pollfd wait = { fd, POLLIN, 0 };
+            if (poll(&wait, 1, -1) < 0 && errno != EINTR) {
+                ::close(fd);
+                cerr << "Error: Lost the file watch (" << strerror(errno) << ")" << endl;
+                return ExitData;
+            }
+            readWatchEvents(fd, layers);
+            changed = any_of(layers.begin(), layers.end(), [](const WatchedLayer& layer) { return layer.changed; });
+        }
+        pollfd settle = { fd, POLLIN, 0 };
+        while (poll(&settle, 1, WatchSettleMs) > 0) {
+            readWatchEvents(fd, layers);
+        }
+        rewatchDirectories(fd, layers);
+        
+        // Size and mtime can survive a copy (cp -p, rsync), so drop the
+        // cached layer outright rather than trust the cache's own check
+        for (WatchedLayer& layer : layers) {
+            if (!layer.changed) continue;
+            cerr << "Reloading " << layer.kind << " data from " << *layer.fileName << endl;
+            layer.cache->invalidate();
+            layer.changed = false;
         }
-        cout << "#" << endl;
-    }
-    
-    // Print bottom border
-    cout << "     ";
-    for (int x = gridX_min - 1; x <= gridX_max; x++) {
-        cout << "# ";
     }
-    cout << "#" << endl;
-    
-    // Print X-axis labels at the bottom
-    cout << "       ";
-    for (int x = gridX_min; x <= gridX_max; x++) {
-        cout << x << " ";
+}
+
+// ------------
+// Query Server
+// ------------
+// --serve SOCKET loads one config or snapshot and answers requests on a Unix
+// domain socket until killed, so consumers don't parse the data files every
+// time. Requests and responses are framed the same way: a 4-byte big-endian
+// length, then that many bytes of text. A response starts with "OK" or
+// "ERROR <message>" on a line of its own, followed by the answer.
+//
+//   point X Y               city ID, cloud, pressure and rain probability
+//   city NAME / id N        the city's forecast, as in the report
+//   region X1 X2 Y1 Y2      sums and means, as --region
+//   map NAME                a map, as --map
+//   reload [FILE]           load the config (or snapshot) again, or FILE
+//
+// One thread runs a poll() loop over every connection, so requests never see
+// each other's changes. Forecasts, region tables and the rain field are built
+// at load time, which keeps point, city and region answers in microseconds;
+// maps are rendered on first request and kept until the next reload.
+//
+// A reload builds the new dataset on a thread of its own while the loop keeps
+// answering from the old one; when it is complete the loop swaps it in and
+// answers the reload. Only one reload runs at a time. A client's requests are
+// answered in order, so one waiting for its reload is not read from, and nor
+// is one with MaxPendingBytes of answers it hasn't taken yet.
+const size_t MaxRequestBytes = 1 << 16;
+const size_t MaxPendingBytes = 1 << 20;
+
+// What the server answers from, besides the engine's dataset
+struct ServerState {
+    BatchInput input;
+    vector<CityForecast> forecasts;       // name order, pointing into the engine's CityNames
+    map<int, size_t> byId;                // city ID to its forecast
+    vector<string> maps;                  // rendered map per mapViews entry, empty until asked for
+};
+
+// A dataset being served; the forecasts point into the engine, so the two
+// are only ever replaced together
+struct ServedData {
+    ForecastEngine engine;
+    ServerState state;
+};
+
+// Load 'input' and everything the requests need into a fresh 'data'
+bool loadServerData(ServedData& data, const BatchInput& input, ostream& log) {
+    ForecastEngine& engine = data.engine;
+    ServerState& state = data.state;
+    state.input = input;
+    LoadContext ctx(log);
+    bool ok = loadBatchInput(engine, input, false, log) && engine.computeWeatherReport(state.forecasts, log) &&
+              engine.ensureRegionTables(ctx) && engine.ensureRainField(ctx);
+    if (!ok) return false;
+    for (size_t i = 0; i < state.forecasts.size(); i++) {
+        state.byId.insert({ state.forecasts[i].id, i });
     }
-    cout << endl;
     
-    waitForEnter();
+    // Files only change what is served through a reload
+    engine.cityCache.pinned = engine.cloudCache.pinned = engine.pressureCache.pinned = true;
+    state.maps.resize(size(mapViews));
+    return true;
 }
 
-// -------------------------------
-// Display Weather Report Function
-// -------------------------------
-// Shows detailed weather forecast for each city
-void displayWeatherReport() {
-    if (!configLoaded) {
-        cout << "Please read config file first!" << endl;
-        waitForEnter();
-        return;
-    }
+// A reload in progress: 'worker' fills 'next' and then writes a byte to
+// 'wake' so the poll() loop picks the result up
+struct ServerReload {
+    thread worker;
+    unique_ptr<ServedData> next;
+    ostringstream log;
+    bool ok = false;
+    uint64_t client = 0; // serial of the client that asked for it
+};
+
+// Answer one request other than reload, status line included
+string answerRequest(ForecastEngine& engine, string_view request, ServerState& state) {
+    string_view command = request.substr(0, request.find(' '));
+    string_view argument = (command.size() < request.size()) ? trimView(request.substr(command.size() + 1)) : string_view();
+    istringstream fields{ string(argument) };
+    ostringstream out;
     
-    // checking data integrity
-    if (!cityGrid || !cloudData || !pressureData) {
-        cout << "Error: Grid data not allocated!" << endl;
-        waitForEnter();
-        return;
+    if (command == "point") {
+        int x, y;
+        if (!(fields >> x >> y)) return "ERROR usage: point X Y\n";
+        if (!engine.cloudData.containsWorld(x, y)) return "ERROR [" + to_string(x) + ", " + to_string(y) + "] is outside the grid\n";
+        out << "OK\n";
+        out << "City ID : " << engine.cityGrid.atWorld(x, y) << "\n";
+        out << "Cloud Cover : " << (int)engine.cloudData.atWorld(x, y) << "\n";
+        out << "Pressure : " << (int)engine.pressureData.atWorld(x, y) << "\n";
+        out << "Probability of Rain (%) : " << (int)engine.rainField.atWorld(x, y) << "\n";
+    } else if (command == "city" || command == "id") {
+        const CityForecast* forecast = nullptr;
+        int id;
+        if (command == "city") {
+            auto found = lower_bound(state.forecasts.begin(), state.forecasts.end(), argument,
+                                     [](const CityForecast& f, string_view name) { return f.name < name; });
+            if (found != state.forecasts.end() && found->name == argument) forecast = &*found;
+        } else if (parseIntField(argument, id)) {
+            auto found = state.byId.find(id);
+            if (found != state.byId.end()) forecast = &state.forecasts[found->second];
+        }
+        if (!forecast) return "ERROR no such city: " + string(argument) + "\n";
+        out << "OK\n";
+        printForecast(out, *forecast);
+    } else if (command == "region") {
+        int x1, x2, y1, y2;
+        if (!(fields >> x1 >> x2 >> y1 >> y2)) return "ERROR usage: region X1 X2 Y1 Y2\n";
+        out << "OK\n";
+        printRegion(out, engine.queryRegion(x1, x2, y1, y2));
+    } else if (command == "map") {
+        const MapView* view = findMapView(string(argument));
+        if (!view) return "ERROR no such map: " + string(argument) + "\n";
+        string& text = state.maps[view - mapViews];
+        if (text.empty()) {
+            Grid<char> symbols;
+            ostringstream log;
+            if (!engine.buildMapView(*view, text, symbols, log)) return "ERROR " + log.str();
+        }
+        return "OK\n" + text;
+    } else {
+        return "ERROR unknown request: " + string(command) + "\n";
     }
-    
-    // Load all data
-    if (!readCityData() || !readCloudData() || !readPressureData()) {
-        waitForEnter();
-        return;
+    return out.str();
+}
+
+void appendFrame(string& out, string_view payload) {
+    uint32_t n = (uint32_t)payload.size();
+    char length[4] = { (char)(n >> 24), (char)(n >> 16), (char)(n >> 8), (char)n };
+    out.append(length, 4).append(payload);
+}
+
+// Length of the frame at the start of 'in', if its header has arrived
+bool frameLength(string_view in, size_t& n) {
+    if (in.size() < 4) return false;
+    const unsigned char* p = (const unsigned char*)in.data();
+    n = ((size_t)p[0] << 24) | ((size_t)p[1] << 16) | ((size_t)p[2] << 8) | p[3];
+    return true;
+}
+
+bool openServerSocket(const string& path, int& listener) {
+    sockaddr_un address = {};
+    if (path.size() >= sizeof(address.sun_path)) {
+        cerr << "Error: Socket path is too long: " << path << endl;
+        return false;
     }
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
     
-    cout << "\nWeather Forecast Summary Report" << endl;
-    cout << "===============================" << endl;
+    // A socket left by a server that was killed; anything else is not ours to remove
+    struct stat info;
+    if (lstat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) ::unlink(path.c_str());
     
-    // Group cities by name to handle multi-cell cities
-    map<string, vector<City>> cityGroups;
-    for (const City& city : cities) {
-        cityGroups[city.name].push_back(city);
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listener < 0 || bind(listener, (const sockaddr*)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0) {
+        cerr << "Error: Cannot listen on " << path << " (" << strerror(errno) << ")" << endl;
+        if (listener >= 0) ::close(listener);
+        return false;
     }
+    return true;
+}
+
+struct ServerClient {
+    int fd;
+    uint64_t serial;      // tells a reloading client from a later one on the same fd
+    string in = {};       // received bytes not yet handled
+    string out = {};      // framed responses not yet sent
+    size_t sent = 0;      // bytes of 'out' already sent
+    bool closing = false;
+    bool reloading = false; // waiting for the answer to its reload
     
-    // Process each unique city
-    for (const auto& cityGroup : cityGroups) {
-        string cityName = cityGroup.first;
-        vector<City> cityAreas = cityGroup.second;
-        
-        // Get city ID from first occurrence
-        int cityID = cityAreas[0].id;
-        
-        // Find all city grid positions
-        vector<pair<int, int>> cityPositions;
-        for (const City& city : cityAreas) {
-            cityPositions.push_back({city.x, city.y});
+    size_t pending() const { return out.size() - sent; }
+    bool readable() const { return !closing && !reloading && pending() == 0 && in.size() < 4 + MaxRequestBytes; }
+};
+
+// Start building the dataset for a reload request from 'client'
+void startReload(ServerReload& reload, const ServerState& state, string_view argument, ServerClient& client, int wake) {
+    BatchInput input = state.input;
+    if (!argument.empty()) input = { string(argument), false };
+    reload.next = make_unique<ServedData>();
+    reload.log.str(string());
+    reload.client = client.serial;
+    client.reloading = true;
+    reload.worker = thread([&reload, input, wake]() {
+        try {
+            reload.ok = loadServerData(*reload.next, input, reload.log);
+        } catch (const exception& e) {
+            reload.log << "Error: " << e.what() << endl;
+            reload.ok = false;
         }
-        
-        // Find surrounding (perimeter) areas - 8-directional neighbors
-        vector<pair<int, int>> perimeterPositions;
-        for (const auto& pos : cityPositions) {
-            // Check 8-directional neighbors (including diagonal)
-            int dx[] = {-1, -1, -1, 0, 0, 1, 1, 1};
-            int dy[] = {-1, 0, 1, -1, 1, -1, 0, 1};
-            
-            for (int i = 0; i < 8; i++) {
-                int nx = pos.first + dx[i];
-                int ny = pos.second + dy[i];
-                
-                // Check if within grid bounds
-                if (nx < gridX_min || nx > gridX_max || ny < gridY_min || ny > gridY_max) {
-                    continue;
-                }
-                
-                // Check if it's not a city position
-                bool isCityPos = false;
-                for (const auto& cityPos : cityPositions) {
-                    if (cityPos.first == nx && cityPos.second == ny) {
-                        isCityPos = true;
-                        break;
-                    }
-                }
-                if (isCityPos) continue;
-                
-                // Check if already added to perimeter (to avoid duplicates)
-                bool alreadyAdded = false;
-                for (size_t k = 0; k < perimeterPositions.size(); k++) {
-                    if (perimeterPositions[k].first == nx && perimeterPositions[k].second == ny) {
-                        alreadyAdded = true;
-                        break;
-                    }
-                }
-                if (!alreadyAdded) {
-                    perimeterPositions.push_back({nx, ny});
-                }
-            }
+        char done = 1;
+        while (write(wake, &done, 1) < 0 && errno == EINTR) {}
+    });
+}
+
+// Swap in the reloaded dataset if it loaded and answer the client that asked
+void finishReload(ServerReload& reload, unique_ptr<ServedData>& served, vector<ServerClient>& clients) {
+    reload.worker.join();
+    string answer;
+    if (reload.ok) {
+        served = std::move(reload.next);
+        answer = "OK\n" + reload.log.str() + "Serving " + served->state.input.path + "\n";
+    } else {
+        reload.next.reset();
+        answer = "ERROR reload failed, still serving " + served->state.input.path + "\n" + reload.log.str();
+    }
+    for (ServerClient& client : clients) {
+        if (client.serial != reload.client) continue;
+        appendFrame(client.out, answer);
+        client.reloading = false;
+    }
+    reload.client = 0;
+}
+
+// Answer the whole requests that have arrived from 'client', in order, until
+// it has to wait for a reload or for its answers to be taken
+void answerClient(ServerClient& client, ServedData& served, ServerReload& reload, int wake) {
+    size_t used = 0, length;
+    while (!client.reloading && client.pending() < MaxPendingBytes && frameLength(string_view(client.in).substr(used), length)) {
+        if (length > MaxRequestBytes) {
+            client.closing = true;
+            break;
         }
+        if (client.in.size() - used < 4 + length) break;
+        string_view request = trimView(string_view(client.in).substr(used + 4, length));
+        used += 4 + length;
         
-        // Calculate ACC (Average Cloud Cover) 
-        double totalCloud = 0;
-        int validCloudAreas = 0;
-        
-        // Sum cloud values from city areas
-        for (const auto& pos : cityPositions) {
-            int gridX = pos.first - gridX_min;
-            int gridY = pos.second - gridY_min;
-            
-            // checking boundaries before accessing
-            if (gridX >= 0 && gridX < grid_width && gridY >= 0 && gridY < grid_height) {
-                totalCloud += cloudData[gridY][gridX];
-                validCloudAreas++;
+        string_view command = request.substr(0, request.find(' '));
+        if (command == "reload") {
+            if (reload.client) {
+                appendFrame(client.out, "ERROR a reload is already running\n");
+            } else {
+                string_view argument = (command.size() < request.size()) ? trimView(request.substr(command.size() + 1)) : string_view();
+                startReload(reload, served.state, argument, client, wake);
             }
+            continue;
         }
-        
-        // Sum cloud values from perimeter areas
-        for (const auto& pos : perimeterPositions) {
-            int gridX = pos.first - gridX_min;
-            int gridY = pos.second - gridY_min;
-            
-            // checking boundaries before accessing
-            if (gridX >= 0 && gridX < grid_width && gridY >= 0 && gridY < grid_height) {
-                totalCloud += cloudData[gridY][gridX];
-                validCloudAreas++;
-            }
+        try {
+            appendFrame(client.out, answerRequest(served.engine, request, served.state));
+        } catch (const exception& e) {
+            appendFrame(client.out, string("ERROR ") + e.what() + "\n");
+        }
+    }
+    client.in.erase(0, used);
+}
+
+int runServer(const BatchInput& input, const string& socketPath) {
+    auto served = make_unique<ServedData>();
+    if (!loadServerData(*served, input, cerr)) return ExitData;
+    int listener;
+    if (!openServerSocket(socketPath, listener)) return ExitUsage;
+    int wakePipe[2];
+    if (pipe2(wakePipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+        cerr << "Error: Cannot create reload pipe (" << strerror(errno) << ")" << endl;
+        return ExitData;
+    }
+    cerr << "Serving " << input.path << " on " << socketPath << endl;
+    
+    ServerReload reload;
+    vector<ServerClient> clients;
+    vector<pollfd> fds;
+    uint64_t serials = 0;
+    char buffer[1 << 16];
+    while (true) {
+        fds.assign({ { listener, POLLIN, 0 }, { wakePipe[0], POLLIN, 0 } });
+        for (const ServerClient& client : clients) {
+            short events = (short)((client.readable() ? POLLIN : 0) | (client.pending() > 0 ? POLLOUT : 0));
+            // One that hung up mid-reload would report POLLHUP on every pass, leave it out until then
+            fds.push_back({ (client.closing && events == 0) ? -1 : client.fd, events, 0 });
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            cerr << "Error: poll failed (" << strerror(errno) << ")" << endl;
+            if (reload.worker.joinable()) reload.worker.join();
+            return ExitData;
         }
         
-        // checking div by 0
-        double ACC = (validCloudAreas > 0) ? totalCloud / validCloudAreas : 0;
-        
-        // Calculate AP (Average Pressure) with 
-        double totalPressure = 0;
-        int validPressureAreas = 0;
-        
-        // Sum pressure values from city areas
-        for (const auto& pos : cityPositions) {
-            int gridX = pos.first - gridX_min;
-            int gridY = pos.second - gridY_min;
-            
-            // checking boundaries before accessing
-            if (gridX >= 0 && gridX < grid_width && gridY >= 0 && gridY < grid_height) {
-                totalPressure += pressureData[gridY][gridX];
-                validPressureAreas++;
-            }
+        if (fds[1].revents & POLLIN) {
+            while (read(wakePipe[0], buffer, sizeof(buffer)) > 0) {}
+            finishReload(reload, served, clients);
         }
         
-        // Sum pressure values from perimeter areas
-        for (const auto& pos : perimeterPositions) {
-            int gridX = pos.first - gridX_min;
-            int gridY = pos.second - gridY_min;
+        for (size_t i = 0; i < clients.size(); i++) {
+            ServerClient& client = clients[i];
+            short events = fds[i + 2].revents;
+            if ((events & (POLLHUP | POLLERR)) && !client.readable()) {
+                // Gone while we weren't reading: nobody is left to take the answers
+                client.closing = true;
+                client.sent = client.out.size();
+            } else if (events & (POLLIN | POLLHUP | POLLERR)) {
+                ssize_t n = 0;
+                while (client.in.size() < 4 + MaxRequestBytes && (n = recv(client.fd, buffer, sizeof(buffer), 0)) > 0) {
+                    client.in.append(buffer, n);
+                }
+                if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) client.closing = true;
+            }
             
-            // checking boundaries before accessing
-            if (gridX >= 0 && gridX < grid_width && gridY >= 0 && gridY < grid_height) {
-                totalPressure += pressureData[gridY][gridX];
-                validPressureAreas++;
+            // Also picks up requests held back while earlier answers were waiting
+            answerClient(client, *served, reload, wakePipe[1]);
+            while (client.pending() > 0) {
+                ssize_t n = send(client.fd, client.out.data() + client.sent, client.pending(), MSG_NOSIGNAL);
+                if (n < 0) {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                        client.closing = true; // nobody left to read the rest
+                        client.sent = client.out.size();
+                    }
+                    break;
+                }
+                client.sent += n;
+            }
+            if (client.pending() == 0) {
+                client.out.clear();
+                client.sent = 0;
             }
         }
         
-        // checking div by 0
-        double AP = (validPressureAreas > 0) ? totalPressure / validPressureAreas : 0;
-        
-        // Determine LMH symbols for ACC and AP
-        char accSymbol = (ACC < 35) ? 'L' : (ACC < 65) ? 'M' : 'H';
-        char apSymbol = (AP < 35) ? 'L' : (AP < 65) ? 'M' : 'H';
-        
-        // Lookup probability of rain based on the table in Appendix E
-        int rainProbability = 50; // Default
-        
-        if (accSymbol == 'H' && apSymbol == 'L') {
-            rainProbability = 90;
-        }
-        else if (accSymbol == 'M' && apSymbol == 'L') {
-            rainProbability = 80;
-        }
-        else if (accSymbol == 'L' && apSymbol == 'L') {
-            rainProbability = 70;
-        }
-        else if (accSymbol == 'H' && apSymbol == 'M') {
-            rainProbability = 60;
-        }
-        else if (accSymbol == 'M' && apSymbol == 'M') {
-            rainProbability = 50;
-        }
-        else if (accSymbol == 'L' && apSymbol == 'M') {
-            rainProbability = 40;
-        }
-        else if (accSymbol == 'H' && apSymbol == 'H') {
-            rainProbability = 30;
-        }
-        else if (accSymbol == 'M' && apSymbol == 'H') {
-            rainProbability = 20;
-        }
-        else if (accSymbol == 'L' && apSymbol == 'H') {
-            rainProbability = 10;
-        }
-        
-        // Display city report
-        cout << "\nCity Name : " << cityName << endl;
-        cout << "City ID : " << cityID << endl;
-        cout << "Ave. Cloud Cover (ACC) : " << fixed << setprecision(2) << ACC << " (" << accSymbol << ")" << endl;
-        cout << "Ave. Pressure (AP) : " << fixed << setprecision(2) << AP << " (" << apSymbol << ")" << endl;
-        cout << "Probability of Rain (%) : " << fixed << setprecision(2) << (double)rainProbability << endl;
+        // A client that hung up still gets the answers it asked for
+        clients.erase(remove_if(clients.begin(), clients.end(), [](const ServerClient& client) {
+            if (!client.closing || !client.out.empty() || client.reloading) return false;
+            ::close(client.fd);
+            return true;
+        }), clients.end());
         
-        // ASCII graphics from second code - but with safety
-        if (rainProbability == 90) {
-            cout << "" << endl;                 // 40% base
-            cout << "~" << endl;                // Separator (5 tildes)
-            cout << "\\\\\\\\\\" << endl;          // 50% extra (5 backslashes)
-        }
-        else if (rainProbability == 80) {
-            cout << "" << endl;                 // 40% base
-            cout << "~" << endl;                // Separator
-            cout << "\\\\\\\\" << endl;            // 40% extra (4 backslashes)
-        }
-        else if (rainProbability == 70) {
-            cout << "" << endl;                 // 40% base
-            cout << "~" << endl;                // Separator
-            cout << "\\\\\\" << endl;              // 30% extra (3 backslashes)
-        }
-        else if (rainProbability == 60) {
-            cout << "" << endl;                 // 40% base
-            cout << "~" << endl;                // Separator
-            cout << "\\\\" << endl;                // 20% extra (2 backslashes)
-        }
-        else if (rainProbability == 50) {
-            cout << "" << endl;                 // 40% base
-            cout << "~" << endl;                // Separator
-            cout << "\\" << endl;                  // 10% extra (1 backslash)
-        }
-        else if (rainProbability == 40) {
-            cout << "" << endl;                 // 40% base
-            cout << "~" << endl;                // Separator
-            // No extra (40% total)
-        }
-        else if (rainProbability == 30) {
-            cout << "~" << endl;                  // 30% total (3 tildes)
-            cout << "" << endl;                 // Separator (base + 1)
-        }
-        else if (rainProbability == 20) {
-            cout << "" << endl;                   // 20% total (2 tildes)
-            cout << "~" << endl;                  // Separator (base + 1)
-        }
-        else if (rainProbability == 10) {
-            cout << "~" << endl;                    // 10% total (1 tilde)
-            cout << "" << endl;                   // Separator (base + 1)
+        if (fds[0].revents & POLLIN) {
+            int fd;
+            while ((fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                clients.push_back({ fd, ++serials });
+            }
         }
     }
+}
+
+// --query SOCKET REQUEST: send one request to a server and print the answer.
+// Exits with ExitData when the server answers with an error.
+int runQuery(const string& socketPath, const string& request) {
+    sockaddr_un address = {};
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        cerr << "Error: Socket path is too long: " << socketPath << endl;
+        return ExitUsage;
+    }
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (const sockaddr*)&address, sizeof(address)) != 0) {
+        cerr << "Error: Cannot connect to " << socketPath << " (" << strerror(errno) << ")" << endl;
+        if (fd >= 0) ::close(fd);
+        return ExitData;
+    }
     
-    waitForEnter();
+    string frame;
+    appendFrame(frame, request);
+    string in;
+    size_t length = 0;
+    bool ok = writeAll(fd, frame.data(), frame.size());
+    char buffer[1 << 16];
+    while (ok && !(frameLength(in, length) && in.size() >= 4 + length)) {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR) continue;
+        ok = n > 0;
+        if (ok) in.append(buffer, n);
+    }
+    ::close(fd);
+    if (!ok) {
+        cerr << "Error: No answer from " << socketPath << endl;
+        return ExitData;
+    }
+    
+    string_view answer = string_view(in).substr(4, length);
+    size_t eol = answer.find('\n');
+    string_view status = answer.substr(0, eol);
+    string_view body = (eol == string_view::npos) ? string_view() : answer.substr(eol + 1);
+    if (status != "OK") {
+        cerr << "Error: " << status.substr(min(status.size(), (size_t)6)) << endl << body;
+        return ExitData;
+    }
+    writeOutput(string(body));
+    return ExitOk;
 }
 
-// ------------------------
-// User Interface Functions
-// ------------------------
-// DIsplays the main menu with all available options
-void showMenu() {
-    cout << "Student ID: 8551285" << endl;
-    cout << "Student Name: Jason Agnus Dei Liemanta" << endl;
-    cout << "---------------------------------------------" << endl;
-    cout << "Welcome to Weather Information Processing System!\n" << endl;
-    cout << "1) Read in and process a configuration file" << endl;
-    cout << "2) Display city map" << endl;
-    cout << "3) Display cloud coverage map (cloudiness index)" << endl;
-    cout << "4) Display cloud coverage map (LMH symbols)" << endl;
-    cout << "5) Display atmospheric pressure map (pressure index)" << endl;
-    cout << "6) Display atmospheric pressure map (LMH symbols)" << endl;
-    cout << "7) Show weather forecast summary report" << endl;
-    cout << "8) Quit" << endl;
-    cout << "Please enter your choice : ";
+// -----
+// C API
+// -----
+// The functions declared in weather_engine.h. Each handle is an engine plus
+// the messages of its last call; exceptions (tile file failures) are caught
+// here and reported like any other error.
+struct WxEngine {
+    ForecastEngine engine;
+    string messages;
+};
+
+// Run 'call' with a fresh log, keeping what it writes as the messages
+template <typename Call>
+int runEngineCall(WxEngine* handle, Call call) {
+    if (!handle) return -1; // no engine to keep the messages in
+    ostringstream log;
+    int result = -1;
+    try {
+        if (call(log)) result = 0;
+    } catch (const exception& e) {
+        log << "Error: " << e.what() << endl;
+    }
+    handle->messages = log.str();
+    return result;
 }
 
-// -----------------------
-// Wait for enter function
-// -----------------------
-void waitForEnter() {
-    cout << "\nPress <enter> to go back to main menu...";
-    string dummy;                                        
-    getline(cin, dummy);                            
+extern "C" WxEngine* wx_engine_create(void) {
+    WxEngine* handle = new (nothrow) WxEngine;
+    if (handle) handle->engine.allocateGrids();
+    return handle;
 }
 
-// -------------------------
-// Get Valid Choice Function
-// -------------------------
-int getValidChoice() {
-    int choice;
-    string input;
-    
-    // Loop until valid input
-    while (true) {
-        getline(cin, input);
-        input = trim(input);
-        
-        // Check if input is empty
-        if (input.empty()) {
-            cout << "Please enter a valid choice (1-8): ";
-            continue;
+extern "C" void wx_engine_destroy(WxEngine* engine) {
+    delete engine;
+}
+
+extern "C" int wx_engine_load(WxEngine* engine, const char* path) {
+    return runEngineCall(engine, [&](ostream& log) {
+        if (!path) {
+            log << "Error: No file to load" << endl;
+            return false;
         }
-        
-        // Check if input contains only digits
-        bool isValid = true;
-        for (char c : input) {
-            if (!isdigit(c)) {
-                isValid = false;
-                break;
-            }
+        return loadBatchInput(engine->engine, { path, false }, false, log) && engine->engine.ensureAllData(log);
+    });
+}
+
+extern "C" int wx_engine_write_report(WxEngine* engine, int fd, const char* format) {
+    return runEngineCall(engine, [&](ostream& log) {
+        ReportFormat reportFormat;
+        if (!format || !parseReportFormat(format, reportFormat)) {
+            log << "Error: Unknown format: " << (format ? format : "(null)") << endl;
+            return false;
         }
+        vector<CityForecast> forecasts;
+        if (!engine->engine.computeWeatherReport(forecasts, log)) return false;
         
-        if (!isValid) {
-            cout << "Invalid input! Please enter a number (1-8): ";
-            continue;
+        OutputBuffer out(fd);
+        if (reportFormat == ReportFormat::Text) {
+            out.append("\nWeather Forecast Summary Report\n");
+            out.append("===============================\n");
         }
-        
-        // Convert string to integer
-        try {
-            choice = stoi(input);
-        } catch (const exception& e) {
-            cout << "Invalid input! Please enter a number (1-8): ";
-            continue;
+        writeForecastRecords(out, reportFormat, forecasts);
+        if (!out.flush()) {
+            log << "Error: Could not write report records" << endl;
+            return false;
         }
-        
-        // Check if choice is in valid range
-        if (choice >= 1 && choice <= 8) {
-            return choice;
-        } else {
-            cout << "Please enter a valid choice (1-8): ";
+        return true;
+    });
+}
+
+extern "C" char* wx_engine_map(WxEngine* engine, const char* name) {
+    string text;
+    int result = runEngineCall(engine, [&](ostream& log) {
+        const MapView* view = name ? findMapView(name) : nullptr;
+        if (!view) {
+            log << "Error: Unknown map: " << (name ? name : "(null)") << endl;
+            return false;
         }
-    }
+        Grid<char> symbols;
+        return engine->engine.buildMapView(*view, text, symbols, log);
+    });
+    return (result == 0) ? strdup(text.c_str()) : nullptr;
+}
+
+extern "C" int wx_engine_point(WxEngine* engine, int x, int y, int* cityId, int* cloud, int* pressure, int* rain) {
+    return runEngineCall(engine, [&](ostream& log) {
+        ForecastEngine& data = engine->engine;
+        LoadContext ctx(log);
+        if (!data.ensureCityData(ctx) || !data.ensureRainField(ctx)) return false;
+        if (!data.cloudData.containsWorld(x, y)) {
+            log << "Error: [" << x << ", " << y << "] is outside the grid" << endl;
+            return false;
+        }
+        if (cityId) *cityId = data.cityGrid.atWorld(x, y);
+        if (cloud) *cloud = data.cloudData.atWorld(x, y);
+        if (pressure) *pressure = data.pressureData.atWorld(x, y);
+        if (rain) *rain = data.rainField.atWorld(x, y);
+        return true;
+    });
+}
+
+extern "C" int wx_engine_region(WxEngine* engine, int x1, int x2, int y1, int y2, WxRegion* region) {
+    return runEngineCall(engine, [&](ostream& log) {
+        if (!region) {
+            log << "Error: No WxRegion to fill in" << endl;
+            return false;
+        }
+        LoadContext ctx(log);
+        if (!engine->engine.ensureRegionTables(ctx)) return false;
+        RegionStats stats = engine->engine.queryRegion(x1, x2, y1, y2);
+        *region = { stats.x1, stats.x2, stats.y1, stats.y2, stats.cells, stats.sum[0], stats.sum[1], stats.mean[0], stats.mean[1] };
+        return true;
+    });
+}
+
+extern "C" const char* wx_engine_messages(const WxEngine* engine) {
+    return engine ? engine->messages.c_str() : "";
+}
+
+extern "C" void wx_free(char* text) {
+    free(text);
 }
 
+#ifndef WEATHER_ENGINE_NO_MAIN
+
 // -------------
 // Main Function
 // -------------
-int main() {
+int main(int argc, char* argv[]) {
     int choice = 0;
     
+    // Command-line options
+    string benchmark;
+    vector<BatchInput> inputs;
+    vector<BatchStep> steps;
+    ReportFormat format = ReportFormat::Text;
+    bool verifySnapshots = false;
+    bool stream = false;
+    bool watch = false;
+    string serveSocket;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        int threads = 0, megabytes = 0;
+        array<int, 4> region;
+        if (arg == "--threads" && i + 1 < argc && parseIntField(argv[i + 1], threads)) {
+            if (threads < 0 || (unsigned)threads > maxWorkerThreads()) {
+                cerr << "Error: --threads takes 0 (one per hardware thread) to " << maxWorkerThreads() << endl;
+                return ExitUsage;
+            }
+            workerThreads = (unsigned)threads; // 0 = one per hardware thread
+            i++;
+        } else if (arg == "--memory-budget" && i + 1 < argc && parseIntField(argv[i + 1], megabytes) && megabytes >= 0) {
+            valueLayerBudget = ((size_t)megabytes << 20) / 2; // shared by cloud and pressure
+            i++;
+        } else if (arg == "--bench" && i + 1 < argc) {
+            benchmark = argv[++i];
+        } else if ((arg == "--config" || arg == "--snapshot") && i + 1 < argc) {
+            inputs.push_back({ argv[++i], arg == "--snapshot" });
+        } else if (arg == "--verify") {
+            verifySnapshots = true;
+        } else if (arg == "--stream") {
+            stream = true;
+        } else if (arg == "--watch") {
+            watch = true;
+        } else if (arg == "--serve" && i + 1 < argc) {
+            serveSocket = argv[++i];
+        } else if (arg == "--query" && i + 2 < argc) {
+            return runQuery(argv[i + 1], argv[i + 2]);
+        } else if (arg == "--write-snapshot" && i + 1 < argc) {
+            steps.push_back({ BatchAction::WriteSnapshot, nullptr, argv[++i] });
+        } else if ((arg == "--cloud-delta" || arg == "--pressure-delta") && i + 1 < argc) {
+            steps.push_back({ arg == "--cloud-delta" ? BatchAction::CloudDelta : BatchAction::PressureDelta, nullptr, argv[++i] });
+        } else if (arg == "--export-rain" && i + 1 < argc) {
+            steps.push_back({ BatchAction::ExportRain, nullptr, argv[++i] });
+        } else if (arg == "--format" && i + 1 < argc && parseReportFormat(argv[i + 1], format)) {
+            i++;
+        } else if (arg == "--report") {
+            steps.push_back({ BatchAction::Report, nullptr, string() });
+        } else if (arg == "--region" && i + 1 < argc && parseRegion(argv[i + 1], region)) {
+            steps.push_back({ BatchAction::Region, nullptr, string(), region });
+            i++;
+        } else if (arg == "--map" && i + 1 < argc && findMapView(argv[i + 1])) {
+            steps.push_back({ BatchAction::Map, findMapView(argv[++i]), string() });
+        } else {
+            printUsage(argv[0]);
+            return ExitUsage;
+        }
+    }
+    if (!benchmark.empty()) {
+        return runBenchmark(benchmark);
+    }
+    if (!steps.empty() && inputs.empty()) {
+        cerr << "Error: --report, --map and the other steps need a --config or --snapshot file" << endl;
+        return ExitUsage;
+    }
+    bool writesSnapshot = any_of(steps.begin(), steps.end(), [](const BatchStep& step) {
+        return step.action == BatchAction::WriteSnapshot;
+    });
+    if (writesSnapshot && inputs.size() > 1) {
+        cerr << "Error: --write-snapshot takes a single --config or --snapshot file" << endl;
+        return ExitUsage;
+    }
+    bool reportOnly = !steps.empty() && all_of(steps.begin(), steps.end(), [](const BatchStep& step) {
+        return step.action == BatchAction::Report;
+    });
+    bool anySnapshot = any_of(inputs.begin(), inputs.end(), [](const BatchInput& input) { return input.snapshot; });
+    if (stream && (!reportOnly || anySnapshot)) {
+        cerr << "Error: --stream only computes --report from --config files" << endl;
+        return ExitUsage;
+    }
+    if (watch && (inputs.size() != 1 || anySnapshot || steps.empty() || stream)) {
+        cerr << "Error: --watch needs one --config file and at least one step, without --stream" << endl;
+        return ExitUsage;
+    }
+    if (watch) {
+        return runWatch(inputs[0], steps, format);
+    }
+    if (!serveSocket.empty() && (inputs.size() != 1 || !steps.empty() || stream)) {
+        cerr << "Error: --serve needs one --config or --snapshot file and no other steps" << endl;
+        return ExitUsage;
+    }
+    if (!serveSocket.empty()) {
+        return runServer(inputs[0], serveSocket);
+    }
+    if (!inputs.empty()) {
+        return runBatch(inputs, steps, format, verifySnapshots, stream);
+    }
+    
     // Initialize default grids
-    allocateGrids();
+    ForecastEngine engine;
+    engine.allocateGrids();
     
     // Main Program Loop
     do {
@@ -1049,37 +5536,50 @@ int main() {
         choice = getValidChoice();
         
         // Run Chosen Function
-        switch (choice) {
-            case 1:
-                readConfigFile();
-                break;
-            case 2:
-                displayCityMap();
-                break;
-            case 3:
-                displayCloudCoverageIndex();
-                break;
-            case 4:
-                displayCloudCoverageLMH();
-                break;
-            case 5:
-                displayPressureIndex();
-                break;
-            case 6:
-                displayPressureLMH();
-                break;
-            case 7:
-                displayWeatherReport();
-                break;
-            case 8:
-                cout << "Exiting Weather Information Processing System..." << endl;
-                cout << "Thank you for using the program!" << endl;
-                break;
+        try {
+            switch (choice) {
+                case 1:
+                    readConfigFile(engine);
+                    break;
+                case 2:
+                    displayCityMap(engine);
+                    break;
+                case 3:
+                    displayCloudCoverageIndex(engine);
+                    break;
+                case 4:
+                    displayCloudCoverageLMH(engine);
+                    break;
+                case 5:
+                    displayPressureIndex(engine);
+                    break;
+                case 6:
+                    displayPressureLMH(engine);
+                    break;
+                case 7:
+                    displayWeatherReport(engine);
+                    break;
+                case 8:
+                    displayRegionQuery(engine);
+                    break;
+                case 9:
+                    displayRainProbability(engine);
+                    break;
+                case QuitChoice:
+                    engine.printParseStats(cout);
+                    engine.printLayerCacheStats(cout);
+                    engine.printTileCacheStats(cout);
+                    cout << "Exiting Weather Information Processing System..." << endl;
+                    cout << "Thank you for using the program!" << endl;
+                    break;
+            }
+        } catch (const exception& e) {
+            // out-of-core layers report tile file failures this way
+            cout << "Error: " << e.what() << endl;
+            waitForEnter();
         }
-    } while (choice != 8);
-    
-    // Clean up dynamic memory
-    deallocateGrids();
+    } while (choice != QuitChoice);
     
     return 0;
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,57 @@
+// C interface to the forecast engine in main.cpp, for programs that load
+// weather datasets without going through the menu or the command line.
+// Build the library with:
+//   g++ -std=c++17 -O2 -pthread -fPIC -shared -DWEATHER_ENGINE_NO_MAIN main.cpp -o libweather.so
+//
+// Every engine holds its own dataset, so any number can be used at once as
+// long as each one is only used by one thread at a time. Functions that can
+// fail return 0 on success and -1 otherwise; wx_engine_messages() then holds
+// what went wrong, in the same words the program prints. A NULL engine or
+// a NULL pointer argument where one is required is an error too; with no
+// engine there is nowhere to keep messages, so only -1 (or NULL) tells.
+
+#ifndef WEATHER_ENGINE_H
+#define WEATHER_ENGINE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct WxEngine WxEngine;
+
+// Totals and means of a rectangle, clipped to the grid
+typedef struct WxRegion {
+    int x1, x2, y1, y2;
+    unsigned long long cells;
+    unsigned long long cloudSum, pressureSum;
+    double cloudMean, pressureMean;
+} WxRegion;
+
+WxEngine* wx_engine_create(void);
+void wx_engine_destroy(WxEngine* engine);
+
+// Load a config file or a snapshot, replacing whatever was loaded. Data file
+// names in a config are relative to the directory of the config file.
+int wx_engine_load(WxEngine* engine, const char* path);
+
+// Write the report for every city to 'fd' in "text", "jsonl" or "csv"
+int wx_engine_write_report(WxEngine* engine, int fd, const char* format);
+
+// One of the maps --map accepts, as text. Free the result with wx_free().
+char* wx_engine_map(WxEngine* engine, const char* name);
+
+// City ID (0 for none), cloud, pressure and rain probability (%) of one cell
+int wx_engine_point(WxEngine* engine, int x, int y, int* cityId, int* cloud, int* pressure, int* rain);
+
+int wx_engine_region(WxEngine* engine, int x1, int x2, int y1, int y2, WxRegion* region);
+
+// Messages written by the last call on this engine
+const char* wx_engine_messages(const WxEngine* engine);
+
+void wx_free(char* text);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif